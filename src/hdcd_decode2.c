@@ -32,9 +32,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include "hdcd_decode2.h"
 
 #include "hdcd_tables.c"
+#include "hdcd_simd.c"
 
 // code was developed as part of FFmpeg and uses these macros
 #if !defined(FFMIN)
@@ -52,7 +54,7 @@
  *  always negative but stored positive. */
 #define APPLY_GAIN(s,g) do{int64_t s64 = s; s64 *= gaintab[g]; s = (int32_t)(s64 >> 23); }while(0);
 
-/** used in _hdcd_scan_x() and _hdcd_integrate_x() */
+/** used in _hdcd_scan_x() */
 #define HDCD_MAX_CHANNELS 2
 
 /** internal data structure identities **/
@@ -62,6 +64,8 @@ enum {
     HDCD_SID_STATE_STEREO    = 2,
     HDCD_SID_DETECTION_DATA  = 3,
     HDCD_SID_LOGGER          = 4,
+    HDCD_SID_EVENTS          = 5,
+    HDCD_SID_LUTS            = 6,
 };
 
 static void _hdcd_default_logger(void *ignored, const char* fmt, va_list args) {
@@ -97,6 +101,62 @@ void _hdcd_log(hdcd_log *log, const char* fmt, ...) {
     }
 }
 
+int _hdcd_events_init(hdcd_events *ev) {
+    if (!ev) return -1;
+    memset(ev, 0, sizeof(*ev));
+    ev->sid = HDCD_SID_EVENTS;
+    return 0;
+}
+
+void _hdcd_event(hdcd_events *ev, int type, int channel, int64_t position, int control) {
+    hdcd_event e;
+    if (!ev)
+        return;
+    e.position = position;
+    e.type = type;
+    e.channel = channel;
+    e.control = control;
+    if (ev->func)
+        ev->func(ev->priv, &e);
+    if (ev->ring) {
+        if (ev->count < ev->size) {
+            ev->ring[(ev->head + ev->count) % ev->size] = e;
+            ev->count++;
+        } else
+            ev->lost++;
+    }
+}
+
+int _hdcd_events_read(hdcd_events *ev, hdcd_event *events, int max) {
+    int n = 0;
+    if (!ev || !ev->ring) return 0;
+    while (n < max && ev->count > 0) {
+        events[n++] = ev->ring[ev->head];
+        ev->head = (ev->head + 1) % ev->size;
+        ev->count--;
+    }
+    return n;
+}
+
+int _hdcd_luts_init(hdcd_luts *luts, size_t max_bytes) {
+    size_t max = max_bytes / (HDCD_LUT_SIZE * sizeof(int32_t));
+    if (!luts) return -1;
+    memset(luts, 0, sizeof(*luts));
+    luts->sid = HDCD_SID_LUTS;
+    luts->max = (max < HDCD_LUT_MAX) ? (int)max : HDCD_LUT_MAX;
+    return 0;
+}
+
+void _hdcd_luts_free(hdcd_luts *luts) {
+    int i;
+    if (!luts) return;
+    for (i = 0; i < luts->count; i++)
+        free(luts->lut[i].out);
+    luts->count = 0;
+}
+
+static void _hdcd_select_kernel(void *state);
+
 void _hdcd_reset(hdcd_state *state, unsigned rate, unsigned bits, int sustain_period_ms, int flags)
 {
     int i;
@@ -155,10 +215,18 @@ void _hdcd_reset(hdcd_state *state, unsigned rate, unsigned bits, int sustain_pe
     /* log and location */
     state->log = NULL;
     state->sample_count = 0;
+    state->events = NULL;
+    state->position = 0;
+    state->channel = 0;
+    state->record = NULL;
+    state->map = NULL;
+    state->luts = NULL;
+    state->lsb_shift = 0;
 
     /* analyze mode */
     state->ana_mode = HDCD_ANA_OFF;
     state->_ana_snb = 0;
+    _hdcd_select_kernel(state);
 }
 
 void _hdcd_reset_stereo(hdcd_state_stereo *state, unsigned rate, unsigned bits, int sustain_period_ms, int flags)
@@ -169,8 +237,11 @@ void _hdcd_reset_stereo(hdcd_state_stereo *state, unsigned rate, unsigned bits,
     state->ana_mode = HDCD_ANA_OFF;
     _hdcd_reset(&state->channel[0], rate, bits, sustain_period_ms, flags);
     _hdcd_reset(&state->channel[1], rate, bits, sustain_period_ms, flags);
+    state->channel[1].channel = 1;
     state->val_target_gain = 0;
     state->count_tg_mismatch = 0;
+    state->tgm_event = -1;
+    _hdcd_select_kernel(state);
 }
 
 void _hdcd_set_analyze_mode(void *state, hdcd_ana_mode mode)
@@ -180,8 +251,12 @@ void _hdcd_set_analyze_mode(void *state, hdcd_ana_mode mode)
     if (!state) return;
     if (s->sid == HDCD_SID_STATE)
         s->ana_mode = mode;
-    if (ss->sid == HDCD_SID_STATE_STEREO)
+    if (ss->sid == HDCD_SID_STATE_STEREO) {
         ss->ana_mode = ss->channel[0].ana_mode = ss->channel[1].ana_mode = mode;
+        _hdcd_select_kernel(&ss->channel[0]);
+        _hdcd_select_kernel(&ss->channel[1]);
+    }
+    _hdcd_select_kernel(state);
 }
 
 void _hdcd_attach_logger(void *state, hdcd_log *log)
@@ -195,93 +270,354 @@ void _hdcd_attach_logger(void *state, hdcd_log *log)
         ss->channel[0].log = ss->channel[1].log = log;
 }
 
-static int _hdcd_integrate_x(hdcd_state *states, int channels, int *flag, const int32_t *samples, int count, int stride)
+void _hdcd_attach_events(void *state, hdcd_events *ev)
+{
+    hdcd_state *s = state;
+    hdcd_state_stereo *ss = state;
+    if (!state) return;
+    if (s->sid == HDCD_SID_STATE)
+        s->events = ev;
+    if (ss->sid == HDCD_SID_STATE_STEREO)
+        ss->channel[0].events = ss->channel[1].events = ev;
+}
+
+void _hdcd_attach_luts(void *state, hdcd_luts *luts)
 {
-    uint32_t bits[HDCD_MAX_CHANNELS];
-    int result = count;
-    int i, j, f;
-    *flag = 0;
+    hdcd_state *s = state;
+    hdcd_state_stereo *ss = state;
+    if (!state) return;
+    if (s->sid == HDCD_SID_STATE)
+        s->luts = luts;
+    if (ss->sid == HDCD_SID_STATE_STEREO)
+        ss->channel[0].luts = ss->channel[1].luts = luts;
+}
 
-    memset(bits, 0, sizeof(bits));
-    if (stride < channels) stride = channels;
+/** decode the control code in wbits, where a packet prefix said to
+ *  expect one. Only the error logging and events branch.
+ *  position is the sample with the last bit of the code.
+ *  returns 1 if a valid code was found */
+static int _hdcd_control_code(hdcd_state *state, uint32_t wbits, int64_t position)
+{
+    /* A: 8-bit code  0x7e0fa005[..] */
+    int is_a = (wbits & 0x0fa00500) == 0x0fa00500;
+    /* B: 8-bit code, 8-bit XOR check, 0x7e0fa006[....] */
+    int is_b = !is_a & ((wbits & 0xa0060000) == 0xa0060000);
+    /*                   [..pt gggg]
+     * 0x0fa005[..] -> 0b[00.. 0...], gain part doubled (shifted left 1) */
+    int ok_a = is_a & ((wbits & 0xc8) == 0);
+    /*          check:   [..pt gggg ~(..pt gggg)]
+     * 0xa006[....] -> 0b[.... ....   .... .... ] */
+    int ok_b = is_b & (((wbits ^ (~wbits >> 8 & 255)) & 0xffff00ff) == 0xa0060000);
+    int ok = ok_a | ok_b;
+    uint8_t code = (ok_a) ? (wbits & 255) + (wbits & 7) : wbits >> 8 & 255;
+
+    state->control = (ok) ? code : state->control;
+    state->code_counterA += ok_a;
+    state->code_counterA_almost += is_a & !ok_a;
+    state->code_counterB += ok_b;
+    state->code_counterB_checkfails += is_b & !ok_b;
+
+    /* update counters */
+    state->count_peak_extend += ok & (state->control >> 4);
+    state->count_transient_filter += ok & (state->control >> 5);
+    state->gain_counts[state->control & 15] += ok;
+    state->max_gain = FFMAX(state->max_gain, ok * (state->control & 15));
+
+    if (is_a & !ok_a) {
+        /* one of bits 3, 6, or 7 was not 0 */
+        _hdcd_log(state->log,
+            "hdcd error: Control A almost: 0x%02x near %d\n", wbits & 0xff, state->sample_count);
+    } else if (is_b & !ok_b) {
+        /* XOR check failed */
+        _hdcd_log(state->log,
+            "hdcd error: Control B check failed: 0x%04x (0x%02x vs 0x%02x) near %d\n", wbits & 0xffff, (wbits & 0xff00) >> 8, ~wbits & 0xff, state->sample_count);
+    }
 
-    for (i = 0; i < channels; i++)
-        result = FFMIN(states[i].readahead, result);
+    if (state->events) {
+        if (ok)
+            _hdcd_event(state->events, HDCD_EVENT_PACKET, state->channel, position, state->control);
+        else if (is_a)
+            _hdcd_event(state->events, HDCD_EVENT_ALMOST_A, state->channel, position, wbits & 0xff);
+        else if (is_b)
+            _hdcd_event(state->events, HDCD_EVENT_CHECKFAIL_B, state->channel, position, wbits >> 8 & 0xff);
+    }
+    return ok;
+}
 
-    for (j = result - 1; j >= 0; j--) {
-        for (i = 0; i < channels; i++)
-            bits[i] |= (*(samples++) & 1) << j;
-        samples += stride - channels;
-    }
-
-    for (i = 0; i < channels; i++) {
-        states[i].window = (states[i].window << result) | bits[i];
-        states[i].readahead -= result;
-
-        if (states[i].readahead == 0) {
-            uint32_t wbits = (uint32_t)(states[i].window ^ states[i].window >> 5 ^ states[i].window >> 23);
-            if (states[i].arg) {
-                f = 0;
-                if ((wbits & 0x0fa00500) == 0x0fa00500) {
-                    /* A: 8-bit code  0x7e0fa005[..] */
-                    if ((wbits & 0xc8) == 0) {
-                        /*                   [..pt gggg]
-                         * 0x0fa005[..] -> 0b[00.. 0...], gain part doubled (shifted left 1) */
-                        states[i].control = (wbits & 255) + (wbits & 7);
-                        f = 1;
-                        states[i].code_counterA++;
-                    } else {
-                        /* one of bits 3, 6, or 7 was not 0 */
-                        states[i].code_counterA_almost++;
-                        _hdcd_log(states[i].log,
-                            "hdcd error: Control A almost: 0x%02x near %d\n", wbits & 0xff, states[i].sample_count);
-                    }
-                } else if ((wbits & 0xa0060000) == 0xa0060000) {
-                    /* B: 8-bit code, 8-bit XOR check, 0x7e0fa006[....] */
-                    if (((wbits ^ (~wbits >> 8 & 255)) & 0xffff00ff) == 0xa0060000) {
-                        /*          check:   [..pt gggg ~(..pt gggg)]
-                         * 0xa006[....] -> 0b[.... ....   .... .... ] */
-                        states[i].control = wbits >> 8 & 255;
-                        f = 1;
-                        states[i].code_counterB++;
-                    } else {
-                        /* XOR check failed */
-                        states[i].code_counterB_checkfails++;
-                        _hdcd_log(states[i].log,
-                            "hdcd error: Control B check failed: 0x%04x (0x%02x vs 0x%02x) near %d\n", wbits & 0xffff, (wbits & 0xff00) >> 8, ~wbits & 0xff, states[i].sample_count);
-                    }
+/** find every position in a word from _hdcd_lsb_pack() where
+ *  window ^ window >> 5 ^ window >> 23 would be a packet prefix,
+ *  0x7e0fa005 or 0x7e0fa006. Bit (64 - p) of the result is set when
+ *  the prefix is complete after the pth of the count bits is shifted in.
+ *  Only the positions in m, from _hdcd_prefix_candidates(), are checked. */
+static uint64_t _hdcd_prefix_search(uint64_t window, uint64_t lsb, int count, uint64_t m)
+{
+    uint64_t lo = lsb << (HDCD_LSB_WORD - count), found = 0;
+    while (m) {
+        int p = _hdcd_clz64(m) + 1;
+        uint64_t w = (p < 64) ? window << p | lo >> (64 - p) : lo;
+        uint32_t wbits = (uint32_t)(w ^ w >> 5 ^ w >> 23);
+        if (wbits == 0x7e0fa005 || wbits == 0x7e0fa006)
+            found |= (uint64_t)1 << (64 - p);
+        m &= ~((uint64_t)1 << (64 - p));
+    }
+    return found;
+}
+
+/** shift n bits of a word from _hdcd_lsb_pack(), with count bits not yet
+ *  consumed, into the window */
+static void _hdcd_window_advance(hdcd_state *state, uint64_t lsb, int count, int n)
+{
+    if (n <= 0) return;
+    lsb >>= count - n;
+    if (n < 64)
+        state->window = (state->window << n) | (lsb & (((uint64_t)1 << n) - 1));
+    else
+        state->window = lsb;
+}
+
+void _hdcd_scan_record_free(hdcd_scan_record *rec)
+{
+    if (!rec) return;
+    free(rec->mark);
+    memset(rec, 0, sizeof(*rec));
+}
+
+/** add a mark to the record of a scan */
+static void _hdcd_mark(hdcd_scan_record *rec, int64_t position, int channel, int check, uint32_t wbits)
+{
+    if (rec->count == rec->size) {
+        int size = (rec->size) ? rec->size * 2 : 256;
+        hdcd_scan_mark *mark = realloc(rec->mark, size * sizeof(*mark));
+        if (!mark) {
+            rec->error = 1;
+            return;
+        }
+        rec->mark = mark;
+        rec->size = size;
+    }
+    rec->mark[rec->count].position = position;
+    rec->mark[rec->count].wbits = wbits;
+    rec->mark[rec->count].channel = channel;
+    rec->mark[rec->count].check = check;
+    rec->count++;
+}
+
+uint64_t *_hdcd_lsb_map_streams(hdcd_lsb_map *map, const int32_t *const *samples, const int *count, const uint64_t *window, int n, int shift)
+{
+    const int lanes = 2 * n;
+    uint64_t *lsb, *prefix;
+    int words = 0, i, k;
+
+#define HDCD_MAP_WORDS(i) ((samples[i] && count[i] > 0) ? (count[i] - 1) / HDCD_LSB_WORD + 1 : 0)
+    for (i = 0; i < n; i++)
+        if (HDCD_MAP_WORDS(i) > words) words = HDCD_MAP_WORDS(i);
+
+    /* the window row and a row of zeros to read past the last word */
+    lsb = calloc((size_t)lanes * (2 * (size_t)words + 3), sizeof(*lsb));
+    if (!lsb) return NULL;
+    prefix = lsb + (size_t)lanes * (words + 2);
+
+    /* the same channel of every stream side by side, so a vector of
+     * prefix candidates covers as many streams as it has lanes */
+    for (i = 0; i < n; i++) {
+        lsb[i] = window[2 * i];
+        lsb[n + i] = window[2 * i + 1];
+        for (k = 0; k < HDCD_MAP_WORDS(i); k++) {
+            uint64_t w[2];
+            int c = count[i] - k * HDCD_LSB_WORD;
+            if (c > HDCD_LSB_WORD) c = HDCD_LSB_WORD;
+            _hdcd_lsb_pack(w, 2, samples[i] + (size_t)k * HDCD_LSB_WORD * 2, c, 2, shift);
+            lsb[(size_t)(k + 1) * lanes + i] = w[0] << (HDCD_LSB_WORD - c);
+            lsb[(size_t)(k + 1) * lanes + n + i] = w[1] << (HDCD_LSB_WORD - c);
+        }
+        map[i].start = samples[i];
+        map[i].lsb = lsb + lanes + i;
+        map[i].prefix = prefix + i;
+        map[i].stride = lanes;
+        map[i].cstride = n;
+    }
+#undef HDCD_MAP_WORDS
+    for (k = 0; k < words; k++) {
+        uint64_t *m = prefix + (size_t)k * lanes;
+        const uint64_t *w = lsb + (size_t)k * lanes;
+        _hdcd_prefix_candidates(m, lanes, w, w + lanes, HDCD_LSB_WORD);
+        for (i = 0; i < lanes; i++)
+            if (m[i])
+                m[i] = _hdcd_prefix_search(w[i], w[lanes + i], HDCD_LSB_WORD, m[i]);
+    }
+    return lsb;
+}
+
+/** 64 frames of a channel of an hdcd_lsb_map, from frame o */
+static inline uint64_t _hdcd_map_bits(const uint64_t *w, int stride, int o)
+{
+    const uint64_t *p = w + (size_t)(o / HDCD_LSB_WORD) * stride;
+    int s = o % HDCD_LSB_WORD;
+    return (s) ? p[0] << s | p[stride] >> (HDCD_LSB_WORD - s) : p[0];
+}
+
+/** scan samples for packets until a valid code is found in any channel,
+ *  flag gets a bit set for each channel where one was.
+ *  returns the number of samples consumed */
+static int _hdcd_scan_lsb(hdcd_state *states, int channels, const int32_t *samples, int max, int stride, int *flag)
+{
+    int result = 0;
+    int i;
+
+    while (result < max) {
+        uint64_t lsb[HDCD_MAX_CHANNELS], found[HDCD_MAX_CHANNELS], window[HDCD_MAX_CHANNELS];
+        int at[HDCD_MAX_CHANNELS];
+        int avail = FFMIN(max - result, HDCD_LSB_WORD);
+        int pos = 0, quiet = 1;
+
+        /* With a map, and no code pending, nothing can happen before the
+         * next prefix. Skip to it as the loop below would. */
+        if (states[0].map) {
+            const hdcd_lsb_map *map = states[0].map;
+            int o = (int)((samples - map->start) / stride);
+            int n = 0, left = max - result, pending = 0;
+            for (i = 0; i < channels; i++)
+                pending |= states[i].arg;
+            while (!pending && n < left) {
+                uint64_t m = 0;
+                for (i = 0; i < channels; i++)
+                    m |= _hdcd_map_bits(map->prefix + i * map->cstride, map->stride, o + n);
+                if (m) {
+                    n += _hdcd_clz64(m);
+                    break;
                 }
-                if (f) {
-                    *flag |= (1<<i);
-                    /* update counters */
-                    if (states[i].control & 16) states[i].count_peak_extend++;
-                    if (states[i].control & 32) states[i].count_transient_filter++;
-                    states[i].gain_counts[states[i].control & 15]++;
-                    states[i].max_gain = FFMAX(states[i].max_gain, (states[i].control & 15));
+                n += HDCD_LSB_WORD;
+            }
+            if (n > left) n = left;
+            if (n > 0) {
+                for (i = 0; i < channels; i++) {
+                    /* the 64 frames before, from word -1 */
+                    states[i].window = _hdcd_map_bits(map->lsb - map->stride + i * map->cstride, map->stride, o + n);
+                    states[i].readahead = (states[i].readahead > n) ? states[i].readahead - n : 1;
                 }
-                states[i].arg = 0;
+                samples += n * stride;
+                result += n;
+                continue;
+            }
+        }
+
+        /* Once the windows are empty, a run of zero LSBs can't contain a
+         * prefix, and without a pending code nothing else can happen.
+         * Skip the whole run as the loop below would. */
+        for (i = 0; i < channels; i++)
+            quiet &= (states[i].window == 0 && !states[i].arg);
+        if (quiet && !states[0].map) {
+            int n = _hdcd_lsb_zero_run(samples, channels, max - result, stride, states[0].lsb_shift);
+            if (n > 0) {
+                for (i = 0; i < channels; i++)
+                    states[i].readahead = (states[i].readahead > n) ? states[i].readahead - n : 1;
+                samples += n * stride;
+                result += n;
+                continue;
             }
-            if (wbits == 0x7e0fa005 || wbits == 0x7e0fa006) {
-                /* 0x7e0fa00[.]-> [0b0101 or 0b0110] */
-                states[i].readahead = (wbits & 3) * 8;
-                states[i].arg = 1;
-                states[i].code_counterC++;
-            } else {
-                if (wbits)
-                    states[i].readahead = readaheadtab[wbits & 0xff];
-                else
-                    states[i].readahead = 31; /* ffwd over digisilence */
+        }
+
+        for (i = 0; i < channels; i++)
+            window[i] = states[i].window;
+        if (states[0].map) {
+            /* packed and searched ahead, with other streams */
+            const hdcd_lsb_map *map = states[0].map;
+            int o = (int)((samples - map->start) / stride);
+            for (i = 0; i < channels; i++) {
+                lsb[i] = _hdcd_map_bits(map->lsb + i * map->cstride, map->stride, o) >> (HDCD_LSB_WORD - avail);
+                found[i] = _hdcd_map_bits(map->prefix + i * map->cstride, map->stride, o) & (~(uint64_t)0 << (HDCD_LSB_WORD - avail));
             }
+        } else {
+            _hdcd_lsb_pack(lsb, channels, samples, avail, stride, states[0].lsb_shift);
+            _hdcd_prefix_candidates(found, channels, window, lsb, avail);
+            for (i = 0; i < channels; i++)
+                if (found[i])
+                    found[i] = _hdcd_prefix_search(window[i], lsb[i], avail, found[i]);
         }
+        samples += avail * stride;
+
+        /* Only visit the positions where something can happen: a pending
+         * code, or a prefix that was found. Nothing can happen between
+         * them, so the bits in between are shifted in all at once. */
+        while (pos < avail) {
+            int next = avail + 1;
+            for (i = 0; i < channels; i++) {
+                at[i] = pos + states[i].readahead;
+                if (!states[i].arg && at[i] <= avail) {
+                    uint64_t m = found[i] & (~(uint64_t)0 >> (at[i] - 1));
+                    at[i] = (m) ? _hdcd_clz64(m) + 1 : avail + 1;
+                }
+                next = FFMIN(next, at[i]);
+            }
+            next = FFMIN(next, avail);
+            for (i = 0; i < channels; i++) {
+                _hdcd_window_advance(&states[i], lsb[i], avail - pos, next - pos);
+                states[i].readahead = at[i] - next;
+            }
+            pos = next;
+
+            for (i = 0; i < channels; i++) {
+                uint32_t wbits;
+                int64_t position;
+                if (at[i] != pos) continue;
+                wbits = (uint32_t)(states[i].window ^ states[i].window >> 5 ^ states[i].window >> 23);
+                position = states[i].position + result + pos - 1;
+                if (states[i].arg) {
+                    if (states[i].record)
+                        _hdcd_mark(states[i].record, position, i, 1, wbits);
+                    *flag |= _hdcd_control_code(&states[i], wbits, position) << i;
+                    states[i].arg = 0;
+                }
+                if (found[i] >> (HDCD_LSB_WORD - pos) & 1) {
+                    /* 0x7e0fa00[.]-> [0b0101 or 0b0110] */
+                    if (states[i].record)
+                        _hdcd_mark(states[i].record, position, i, 0, wbits);
+                    states[i].readahead = (wbits & 3) * 8;
+                    states[i].arg = 1;
+                    states[i].code_counterC++;
+                } else
+                    states[i].readahead = 1;
+            }
+            if (*flag) break;
+        }
+        result += pos;
+        if (*flag) break;
     }
     return result;
 }
 
+/** as _hdcd_scan_lsb(), but take what happened from the marks recorded
+ *  in an earlier scan of the same samples. Only the counters and control
+ *  are updated, the window is left as it was. */
+static int _hdcd_scan_marks(hdcd_state *states, int max, int *flag)
+{
+    hdcd_scan_record *rec = states[0].record;
+    int64_t base = states[0].position, at = base;
+
+    while (rec->next < rec->count) {
+        const hdcd_scan_mark *mark = &rec->mark[rec->next];
+        if (mark->position >= base + max)
+            break;
+        /* the rest of the channels at the same position come first */
+        if (*flag && mark->position != at)
+            break;
+        at = mark->position;
+        if (mark->check)
+            *flag |= _hdcd_control_code(&states[mark->channel], mark->wbits, at) << mark->channel;
+        else
+            states[mark->channel].code_counterC++;
+        rec->next++;
+    }
+    return (*flag) ? (int)(at - base) + 1 : max;
+}
+
+/** scan for packets, or replay a recorded scan when samples is NULL */
 static int _hdcd_scan_x(hdcd_state *states, int channels, const int32_t *samples, int max, int stride)
 {
     int result;
-    int i;
+    int i, flag = 0;
     int cdt_active[HDCD_MAX_CHANNELS];
+    uint8_t cdt_control[HDCD_MAX_CHANNELS];
     memset(cdt_active, 0, sizeof(cdt_active));
 
     if (stride < channels) stride = channels;
@@ -291,6 +627,7 @@ static int _hdcd_scan_x(hdcd_state *states, int channels, const int32_t *samples
         if (states[i].sustain > 0) {
             cdt_active[i] = 1;
             if (states[i].sustain <=  (unsigned)max) {
+                cdt_control[i] = states[i].control;
                 states[i].control = 0;
                 max = states[i].sustain;
             }
@@ -298,31 +635,32 @@ static int _hdcd_scan_x(hdcd_state *states, int channels, const int32_t *samples
         }
     }
 
-    result = 0;
-    while (result < max) {
-        int flag;
-        int consumed = _hdcd_integrate_x(states, channels, &flag, samples, max - result, stride);
-        result += consumed;
-        if (flag) {
-            /* reset timer if code detected in a channel */
-            for(i = 0; i < channels; i++) {
-                if (flag & (1<<i)) {
-                    states[i].sustain = states[i].sustain_reset;
-                    /* if this is the first reset then change
-                     * from never set, to never expired */
-                    if (states[i].count_sustain_expired == -1)
-                        states[i].count_sustain_expired = 0;
-                }
+    if (samples)
+        result = _hdcd_scan_lsb(states, channels, samples, max, stride, &flag);
+    else
+        result = _hdcd_scan_marks(states, max, &flag);
+
+    if (flag) {
+        /* reset timer if code detected in a channel */
+        for(i = 0; i < channels; i++) {
+            if (flag & (1<<i)) {
+                states[i].sustain = states[i].sustain_reset;
+                /* if this is the first reset then change
+                 * from never set, to never expired */
+                if (states[i].count_sustain_expired == -1)
+                    states[i].count_sustain_expired = 0;
             }
-            break;
         }
-        samples += consumed * stride;
     }
 
     for(i = 0; i < channels; i++) {
+        states[i].position += result;
         /* code detect timer expired */
-        if (cdt_active[i] && states[i].sustain == 0)
+        if (cdt_active[i] && states[i].sustain == 0) {
             states[i].count_sustain_expired++;
+            if (states[i].events)
+                _hdcd_event(states[i].events, HDCD_EVENT_CDT_EXPIRED, states[i].channel, states[i].position, cdt_control[i]);
+        }
     }
 
     return result;
@@ -414,67 +752,125 @@ static int _hdcd_analyze(int32_t *samples, int count, int stride, int gain, int
     return gain;
 }
 
-/** apply HDCD decoding parameters to a series of samples */
-static int _hdcd_envelope(int32_t *samples, int count, int stride, int bits, int gain, int target_gain, int extend)
-{
-    int i, limit = count * stride;
+/** tables aren't built for shorter runs, they are used when already there */
+#define HDCD_LUT_MIN_RUN 1024
 
-    int pe_level = peak_ext_level, shft = 15;
-    if (bits != 16) {
-        pe_level = (1 << (bits - 1)) - (0x8000 - peak_ext_level);
-        shft = 32 - bits - 1;
-    }
+/* for the kernel templates, so constant arguments are folded into
+ * each kernel */
+#if defined(__GNUC__)
+#define HDCD_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define HDCD_ALWAYS_INLINE inline
+#endif
 
-    if (extend) {
-        for (i = 0; i < limit; i += stride) {
-            int32_t sample = samples[i];
-            int32_t asample = abs(sample) - pe_level;
-            if (asample >= 0) {
-                if (asample > pe_max_asample ) asample = pe_max_asample;
-                sample = sample >= 0 ? peaktab[asample] : -peaktab[asample];
-            } else
-                sample <<= shft;
-
-            samples[i] = sample;
+static HDCD_ALWAYS_INLINE int _hdcd_envelope(int32_t *samples, int count, int stride, int bits, int gain, int target_gain, int extend, hdcd_luts *luts);
+
+/** the table for gain and pe, or NULL when there isn't one and count
+ *  is too short to build it, or it can't be allocated */
+static const int32_t *_hdcd_lut_get(hdcd_luts *luts, int gain, int pe, int count)
+{
+    hdcd_lut *l;
+    int i;
+
+    luts->clock++;
+    for (i = 0; i < luts->count; i++) {
+        l = &luts->lut[i];
+        if (l->gain == gain && l->pe == pe) {
+            l->used = luts->clock;
+            luts->hits++;
+            return l->out;
         }
+    }
+    luts->misses++;
+    if (count < HDCD_LUT_MIN_RUN || !luts->max) return NULL;
+
+    if (luts->count < luts->max) {
+        l = &luts->lut[luts->count];
+        l->out = malloc(HDCD_LUT_SIZE * sizeof(int32_t));
+        if (!l->out) return NULL;
+        luts->count++;
     } else {
-        for (i = 0; i < limit; i += stride)
-            samples[i] <<= shft;
+        /* replace the least recently used */
+        l = &luts->lut[0];
+        for (i = 1; i < luts->count; i++)
+            if (luts->lut[i].used < l->used) l = &luts->lut[i];
     }
+    l->gain = gain;
+    l->pe = pe;
+    l->used = luts->clock;
+    /* every 16-bit value, decoded the usual way */
+    for (i = 0; i < HDCD_LUT_SIZE; i++)
+        l->out[i] = i - 0x8000;
+    _hdcd_envelope(l->out, HDCD_LUT_SIZE, 1, 16, gain, gain, pe, NULL);
+    return l->out;
+}
+
+/** _hdcd_envelope() at a steady gain, from the table. A sample outside
+ *  16 bits isn't in it, and is done the usual way */
+static void _hdcd_lut_run(int32_t *samples, int count, int stride, const int32_t *t, int gain, int extend)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        int32_t *s = samples + i * stride;
+        if ((uint32_t)*s + 0x8000 < HDCD_LUT_SIZE)
+            *s = t[*s + 0x8000];
+        else
+            _hdcd_envelope(s, 1, 1, 16, gain, gain, extend, NULL);
+    }
+}
 
+/** the gain ramp of _hdcd_envelope() toward target_gain, *len is the
+ *  samples it took, the rest are held at the gain returned */
+static int _hdcd_envelope_ramp(int32_t *samples, int count, int stride, int gain, int target_gain, int *len)
+{
     if (gain <= target_gain) {
-        int len = FFMIN(count, target_gain - gain);
+        *len = FFMIN(count, target_gain - gain);
         /* attenuate slowly */
-        for (i = 0; i < len; i++) {
-            ++gain;
-            APPLY_GAIN(*samples, gain);
-            samples += stride;
-        }
-        count -= len;
+        _hdcd_gain_ramp(samples, *len, stride, gain, 1);
+        gain += *len;
     } else {
-        int len = FFMIN(count, (gain - target_gain) >> 3);
+        *len = FFMIN(count, (gain - target_gain) >> 3);
         /* amplify quickly */
-        for (i = 0; i < len; i++) {
-            gain -= 8;
-            APPLY_GAIN(*samples, gain);
-            samples += stride;
-        }
+        _hdcd_gain_ramp(samples, *len, stride, gain, -8);
+        gain -= *len * 8;
         if (gain - 8 < target_gain)
             gain = target_gain;
-        count -= len;
     }
+    return gain;
+}
 
-    /* hold a steady level */
-    if (gain == 0) {
-        if (count > 0)
-            samples += count * stride;
-    } else {
-        while (--count >= 0) {
-            APPLY_GAIN(*samples, gain);
-            samples += stride;
+/** apply HDCD decoding parameters to a series of samples */
+static HDCD_ALWAYS_INLINE int _hdcd_envelope(int32_t *samples, int count, int stride, int bits, int gain, int target_gain, int extend, hdcd_luts *luts)
+{
+    int len;
+    int pe_level = peak_ext_level, shft = 15;
+    if (bits != 16) {
+        pe_level = (1 << (bits - 1)) - (0x8000 - peak_ext_level);
+        shft = 32 - bits - 1;
+    }
+
+    /* a plain shift is quicker than a table */
+    if (luts && bits == 16 && gain == target_gain && (gain || extend) && count > 0) {
+        const int32_t *t = _hdcd_lut_get(luts, gain, extend, count);
+        if (t) {
+            _hdcd_lut_run(samples, count, stride, t, gain, extend);
+            return gain;
         }
     }
 
+    if (extend)
+        _hdcd_peak_extend_run(samples, count, stride, pe_level, shft);
+    else
+        _hdcd_shift_run(samples, count, stride, shft);
+
+    gain = _hdcd_envelope_ramp(samples, count, stride, gain, target_gain, &len);
+    samples += len * stride;
+    count -= len;
+
+    /* hold a steady level */
+    if (gain != 0 && count > 0)
+        _hdcd_gain_hold(samples, count, stride, gaintab[gain]);
+
     return gain;
 }
 
@@ -495,9 +891,19 @@ static hdcd_control_result _hdcd_control_stereo(hdcd_state_stereo *state, int *p
     int target_gain[2];
     _hdcd_control(&state->channel[0], peak_extend0, &target_gain[0]);
     _hdcd_control(&state->channel[1], peak_extend1, &target_gain[1]);
-    if (target_gain[0] == target_gain[1])
+    if (target_gain[0] == target_gain[1]) {
         state->val_target_gain = target_gain[0];
-    else {
+        state->tgm_event = -1;
+    } else {
+        /* once for each new pair of values, the control codes
+         * are checked again at every run */
+        int tgm = target_gain[0] << 4 | target_gain[1] >> 7;
+        if (tgm != state->tgm_event && state->channel[0].events) {
+            int64_t position = FFMAX(state->channel[0].position - 1, 0);
+            _hdcd_event(state->channel[0].events, HDCD_EVENT_TG_MISMATCH, 0, position, state->channel[0].control);
+            _hdcd_event(state->channel[0].events, HDCD_EVENT_TG_MISMATCH, 1, position, state->channel[1].control);
+        }
+        state->tgm_event = tgm;
         if (!(state->channel[0].decoder_options & HDCD_FLAG_TGM_LOG_OFF)) {
             _hdcd_log(state->channel[0].log,
                "hdcd error: Unmatched target_gain near %d: tg0: %0.1f, tg1: %0.1f, lvg: %0.1f\n",
@@ -511,14 +917,65 @@ static hdcd_control_result _hdcd_control_stereo(hdcd_state_stereo *state, int *p
     return HDCD_OK;
 }
 
-void _hdcd_process(hdcd_state *state, int32_t *samples, int count, int stride)
+/** the control of a and b is the same */
+static inline int _hdcd_change_same(const hdcd_change *a, const hdcd_change *b)
+{
+    return a->target_gain == b->target_gain
+        && a->peak_extend[0] == b->peak_extend[0] && a->peak_extend[1] == b->peak_extend[1]
+        && a->sustain[0] == b->sustain[0] && a->sustain[1] == b->sustain[1]
+        && a->tgm == b->tgm;
+}
+
+/* The runs of a block are listed first and applied after, so the scan
+ * and the envelope each go through the block without stopping for the
+ * other. */
+
+/** runs listed before they are applied */
+#define HDCD_CHANGES 64
+
+/** add a run to the list. When nothing changed since the last, it is
+ *  only longer: the envelope carries on the same across the join.
+ *  returns the number in the list */
+static inline int _hdcd_change_add(hdcd_change *list, int n, const hdcd_change *c)
 {
+    if (n && _hdcd_change_same(&list[n - 1], c)) {
+        list[n - 1].count += c->count;
+        return n;
+    }
+    list[n] = *c;
+    return n + 1;
+}
+
+/** apply the listed runs to samples, returns the sample after them */
+static HDCD_ALWAYS_INLINE int32_t *_hdcd_changes_apply(hdcd_state *state, int32_t *samples, int stride, const hdcd_change *list, int n, int bits, int ana, int *gain)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        const hdcd_change *c = &list[i];
+        if (ana)
+            *gain = _hdcd_analyze(samples, c->count, stride, *gain, c->target_gain, c->peak_extend[0], state->ana_mode, c->sustain[0], -1);
+        else
+            *gain = _hdcd_envelope(samples, c->count, stride, bits, *gain, c->target_gain, c->peak_extend[0], state->luts);
+        samples += c->count * stride;
+    }
+    return samples;
+}
+
+/** _hdcd_process(), built by HDCD_KERNEL for a bit depth, or 0 for the
+ *  depth in state, and analyze mode on or off */
+static HDCD_ALWAYS_INLINE void _hdcd_process_k(hdcd_state *state, int32_t *samples, int count, int stride, const int kbits, const int ana)
+{
+    const int bits = (kbits) ? kbits : state->bits;
     int full_count = count;
     int gain = state->running_gain;
     int peak_extend, target_gain;
     int lead = 0;
+    int32_t *out = samples;
+    hdcd_change list[HDCD_CHANGES], c;
+    int n = 0;
 
-    if (state->ana_mode)
+    memset(&c, 0, sizeof(c));
+    if (ana)
         _hdcd_analyze_prepare(state, samples, count, stride);
 
     _hdcd_control(state, &peak_extend, &target_gain);
@@ -529,10 +986,15 @@ void _hdcd_process(hdcd_state *state, int32_t *samples, int count, int stride)
         run = _hdcd_scan_x(state, 1, samples + lead * stride, count - lead, stride) + lead;
         envelope_run = run - 1;
 
-        if (state->ana_mode)
-            gain = _hdcd_analyze(samples, envelope_run, stride, gain, target_gain, peak_extend, state->ana_mode, state->sustain, -1);
-        else
-            gain = _hdcd_envelope(samples, envelope_run, stride, state->bits, gain, target_gain, peak_extend);
+        if (n == HDCD_CHANGES) {
+            out = _hdcd_changes_apply(state, out, stride, list, n, bits, ana, &gain);
+            n = 0;
+        }
+        c.count = envelope_run;
+        c.target_gain = target_gain;
+        c.peak_extend[0] = peak_extend;
+        if (ana) c.sustain[0] = state->sustain;
+        n = _hdcd_change_add(list, n, &c);
 
         samples += envelope_run * stride;
         count -= envelope_run;
@@ -540,26 +1002,130 @@ void _hdcd_process(hdcd_state *state, int32_t *samples, int count, int stride)
         _hdcd_control(state, &peak_extend, &target_gain);
     }
     if (lead > 0) {
-        if (state->ana_mode)
-            gain = _hdcd_analyze(samples, lead, stride, gain, target_gain, peak_extend, state->ana_mode, state->sustain, -1);
-        else
-            gain = _hdcd_envelope(samples, lead, stride, state->bits, gain, target_gain, peak_extend);
+        if (n == HDCD_CHANGES) {
+            out = _hdcd_changes_apply(state, out, stride, list, n, bits, ana, &gain);
+            n = 0;
+        }
+        c.count = lead;
+        c.target_gain = target_gain;
+        c.peak_extend[0] = peak_extend;
+        if (ana) c.sustain[0] = state->sustain;
+        n = _hdcd_change_add(list, n, &c);
     }
+    _hdcd_changes_apply(state, out, stride, list, n, bits, ana, &gain);
 
     state->running_gain = gain;
     state->sample_count += full_count;
 }
 
-void _hdcd_process_stereo(hdcd_state_stereo *state, int32_t *samples, int count)
+/** _hdcd_envelope() for both channels of interlaced stereo, in one pass
+ *  where both are at a steady level. The ramps are done for each
+ *  channel, and a channel that is done with its ramp first holds its
+ *  level until the other is done too. */
+static HDCD_ALWAYS_INLINE void _hdcd_envelope_stereo(hdcd_state_stereo *state, int32_t *samples, int count, int bits, int *gain, int target_gain, const int *peak_extend)
+{
+    int pe_level = peak_ext_level, shft = 15;
+    int len[2], hold, c;
+
+    if (bits != 16) {
+        pe_level = (1 << (bits - 1)) - (0x8000 - peak_ext_level);
+        shft = 32 - bits - 1;
+    }
+
+    /* tables are per channel */
+    if (bits == 16 && state->channel[0].luts) {
+        gain[0] = _hdcd_envelope(samples, count, 2, bits, gain[0], target_gain, peak_extend[0], state->channel[0].luts);
+        gain[1] = _hdcd_envelope(samples + 1, count, 2, bits, gain[1], target_gain, peak_extend[1], state->channel[1].luts);
+        return;
+    }
+
+    /* without HDCD, or between its effects, this is all there is */
+    if (peak_extend[0] || peak_extend[1])
+        _hdcd_peak_extend_stereo(samples, count, peak_extend[0], peak_extend[1], pe_level, shft);
+    else
+        _hdcd_shift_run(samples, count * 2, 1, shft);
+
+    for (c = 0; c < 2; c++)
+        gain[c] = _hdcd_envelope_ramp(samples + c, count, 2, gain[c], target_gain, &len[c]);
+    hold = FFMAX(len[0], len[1]);
+    for (c = 0; c < 2; c++)
+        if (gain[c] && len[c] < hold)
+            _hdcd_gain_hold(samples + len[c] * 2 + c, hold - len[c], 2, gaintab[gain[c]]);
+    if ((gain[0] || gain[1]) && count > hold)
+        _hdcd_gain_hold_stereo(samples + hold * 2, count - hold, gaintab[gain[0]], gaintab[gain[1]]);
+}
+
+/** _hdcd_envelope_stereo() for float samples x, as _hdcd_float_run().
+ *  s are the same samples as integers */
+static void _hdcd_envelope_stereo_float(float *x, const int32_t *s, int count, int bits, int *gain, int target_gain, const int *peak_extend)
 {
+    int pe_level = peak_ext_level;
+    int len[2], hold, c;
+
+    if (bits != 16)
+        pe_level = (1 << (bits - 1)) - (0x8000 - peak_ext_level);
+
+    for (c = 0; c < 2; c++) {
+        int g = gain[c];
+        if (g <= target_gain) {
+            len[c] = FFMIN(count, target_gain - g);
+            _hdcd_float_run(x + c, s + c, len[c], peak_extend[c], pe_level, g, 1);
+        } else {
+            len[c] = FFMIN(count, (g - target_gain) >> 3);
+            _hdcd_float_run(x + c, s + c, len[c], peak_extend[c], pe_level, g, -8);
+        }
+        gain[c] = _hdcd_gain_run(count, g, target_gain);
+    }
+    hold = FFMAX(len[0], len[1]);
+    for (c = 0; c < 2; c++)
+        if (len[c] < hold)
+            _hdcd_float_run(x + len[c] * 2 + c, s + len[c] * 2 + c, hold - len[c], peak_extend[c], pe_level, gain[c], 0);
+    if (count > hold)
+        _hdcd_float_hold_stereo(x + hold * 2, s + hold * 2, count - hold, peak_extend[0], peak_extend[1], pe_level,
+            HDCD_FLOAT_GAIN(gain[0]), HDCD_FLOAT_GAIN(gain[1]));
+}
+
+/** _hdcd_changes_apply() for stereo. With fout, the envelope is done
+ *  in float to fout, and samples are only read */
+static HDCD_ALWAYS_INLINE int32_t *_hdcd_changes_apply_stereo(hdcd_state_stereo *state, int32_t *samples, float *fout, const hdcd_change *list, int n, int bits, int ana, int *gain)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        const hdcd_change *c = &list[i];
+        if (fout) {
+            _hdcd_envelope_stereo_float(fout, samples, c->count, bits, gain, c->target_gain, c->peak_extend);
+            fout += c->count * 2;
+        } else if (ana) {
+            gain[0] = _hdcd_analyze(samples, c->count, 2, gain[0], c->target_gain, c->peak_extend[0],
+                state->ana_mode, c->sustain[0], c->tgm);
+            gain[1] = _hdcd_analyze(samples + 1, c->count, 2, gain[1], c->target_gain, c->peak_extend[1],
+                state->ana_mode, c->sustain[1], c->tgm);
+        } else
+            _hdcd_envelope_stereo(state, samples, c->count, bits, gain, c->target_gain, c->peak_extend);
+        samples += c->count * 2;
+    }
+    return samples;
+}
+
+/** _hdcd_process_stereo(), as _hdcd_process_k(). With fout, the
+ *  decoded samples are floats written there instead, see
+ *  _hdcd_process_stereo_float() */
+static HDCD_ALWAYS_INLINE void _hdcd_process_stereo_k(hdcd_state_stereo *state, int32_t *samples, float *fout, int count, const int kbits, const int ana)
+{
+    const int bits = (kbits) ? kbits : state->channel[0].bits;
     const int stride = 2;
     int full_count = count;
     int gain[2] = {state->channel[0].running_gain, state->channel[1].running_gain};
     int peak_extend[2];
     int lead = 0;
     int ctlret;
+    int32_t *const block = samples;
+    int32_t *out = samples;
+    hdcd_change list[HDCD_CHANGES], c;
+    int n = 0;
 
-    if (state->ana_mode) {
+    memset(&c, 0, sizeof(c));
+    if (ana) {
         _hdcd_analyze_prepare(&state->channel[0], samples, count, stride);
         _hdcd_analyze_prepare(&state->channel[1], samples + 1, count, stride);
     }
@@ -574,19 +1140,20 @@ void _hdcd_process_stereo(hdcd_state_stereo *state, int32_t *samples, int count)
         if (ctlret == HDCD_TG_MISMATCH)
             state->count_tg_mismatch += envelope_run;
 
-        if (state->ana_mode) {
-            gain[0] = _hdcd_analyze(samples, envelope_run, stride, gain[0], state->val_target_gain, peak_extend[0],
-                state->ana_mode,
-                state->channel[0].sustain,
-                (ctlret == HDCD_TG_MISMATCH) );
-            gain[1] = _hdcd_analyze(samples + 1, envelope_run, stride, gain[1], state->val_target_gain, peak_extend[1],
-                state->ana_mode,
-                state->channel[1].sustain,
-                (ctlret == HDCD_TG_MISMATCH) );
-        } else {
-            gain[0] = _hdcd_envelope(samples, envelope_run, stride, state->channel[0].bits, gain[0], state->val_target_gain, peak_extend[0]);
-            gain[1] = _hdcd_envelope(samples + 1, envelope_run, stride, state->channel[1].bits, gain[1], state->val_target_gain, peak_extend[1]);
+        if (n == HDCD_CHANGES) {
+            out = _hdcd_changes_apply_stereo(state, out, (fout) ? fout + (out - block) : NULL, list, n, bits, ana, gain);
+            n = 0;
+        }
+        c.count = envelope_run;
+        c.target_gain = state->val_target_gain;
+        c.peak_extend[0] = peak_extend[0];
+        c.peak_extend[1] = peak_extend[1];
+        if (ana) {
+            c.sustain[0] = state->channel[0].sustain;
+            c.sustain[1] = state->channel[1].sustain;
+            c.tgm = (ctlret == HDCD_TG_MISMATCH);
         }
+        n = _hdcd_change_add(list, n, &c);
 
         samples += envelope_run * stride;
         count -= envelope_run;
@@ -598,18 +1165,240 @@ void _hdcd_process_stereo(hdcd_state_stereo *state, int32_t *samples, int count)
         if (ctlret == HDCD_TG_MISMATCH)
             state->count_tg_mismatch += lead;
 
-        if (state->ana_mode) {
-            gain[0] = _hdcd_analyze(samples, lead, stride, gain[0], state->val_target_gain, peak_extend[0],
-                state->ana_mode,
-                state->channel[0].sustain,
-                (ctlret == HDCD_TG_MISMATCH) );
-            gain[1] = _hdcd_analyze(samples + 1, lead, stride, gain[1], state->val_target_gain, peak_extend[1],
-                state->ana_mode,
-                state->channel[1].sustain,
-                (ctlret == HDCD_TG_MISMATCH) );
-        } else {
-            gain[0] = _hdcd_envelope(samples, lead, stride, state->channel[0].bits, gain[0], state->val_target_gain, peak_extend[0]);
-            gain[1] = _hdcd_envelope(samples + 1, lead, stride, state->channel[1].bits, gain[1], state->val_target_gain, peak_extend[1]);
+        if (n == HDCD_CHANGES) {
+            out = _hdcd_changes_apply_stereo(state, out, (fout) ? fout + (out - block) : NULL, list, n, bits, ana, gain);
+            n = 0;
+        }
+        c.count = lead;
+        c.target_gain = state->val_target_gain;
+        c.peak_extend[0] = peak_extend[0];
+        c.peak_extend[1] = peak_extend[1];
+        if (ana) {
+            c.sustain[0] = state->channel[0].sustain;
+            c.sustain[1] = state->channel[1].sustain;
+            c.tgm = (ctlret == HDCD_TG_MISMATCH);
+        }
+        n = _hdcd_change_add(list, n, &c);
+    }
+    _hdcd_changes_apply_stereo(state, out, (fout) ? fout + (out - block) : NULL, list, n, bits, ana, gain);
+
+    state->channel[0].running_gain = gain[0];
+    state->channel[1].running_gain = gain[1];
+
+    state->channel[0].sample_count += full_count;
+    state->channel[1].sample_count += full_count;
+}
+
+void _hdcd_apply_stereo(hdcd_state_stereo *state, int32_t *samples, const hdcd_change *list, int n, int *gain)
+{
+    _hdcd_changes_apply_stereo(state, samples, NULL, list, n, state->channel[0].bits, 0, gain);
+}
+
+/** one kernel of each, n-channel and stereo */
+#define HDCD_KERNEL(name, kbits, ana) \
+static void _hdcd_process_##name(void *state, int32_t *samples, int count, int stride) \
+    { _hdcd_process_k(state, samples, count, stride, kbits, ana); } \
+static void _hdcd_process_stereo_##name(void *state, int32_t *samples, int count, int stride) \
+    { (void)stride; _hdcd_process_stereo_k(state, samples, NULL, count, kbits, ana); }
+
+HDCD_KERNEL(16, 16, 0)
+HDCD_KERNEL(20, 20, 0)
+HDCD_KERNEL(24, 24, 0)
+HDCD_KERNEL(any, 0, 0)
+HDCD_KERNEL(16_ana, 16, 1)
+HDCD_KERNEL(20_ana, 20, 1)
+HDCD_KERNEL(24_ana, 24, 1)
+HDCD_KERNEL(any_ana, 0, 1)
+
+/* [stereo][ana][depth], see _hdcd_select_kernel() */
+static hdcd_kernel * const hdcd_kernels[2][2][4] = {
+    { { _hdcd_process_16, _hdcd_process_20, _hdcd_process_24, _hdcd_process_any },
+      { _hdcd_process_16_ana, _hdcd_process_20_ana, _hdcd_process_24_ana, _hdcd_process_any_ana } },
+    { { _hdcd_process_stereo_16, _hdcd_process_stereo_20, _hdcd_process_stereo_24, _hdcd_process_stereo_any },
+      { _hdcd_process_stereo_16_ana, _hdcd_process_stereo_20_ana, _hdcd_process_stereo_24_ana, _hdcd_process_stereo_any_ana } },
+};
+
+/** the kernel for the bit depth and analyze mode, picked when either
+ *  changes instead of checked in the runs */
+static void _hdcd_select_kernel(void *state)
+{
+    hdcd_state *s = state;
+    hdcd_state_stereo *ss = state;
+    int depth;
+    if (!state) return;
+    if (s->sid == HDCD_SID_STATE) {
+        depth = (s->bits == 16) ? 0 : (s->bits == 20) ? 1 : (s->bits == 24) ? 2 : 3;
+        s->process = hdcd_kernels[0][!!s->ana_mode][depth];
+    }
+    if (ss->sid == HDCD_SID_STATE_STEREO) {
+        s = &ss->channel[0];
+        depth = (s->bits == 16) ? 0 : (s->bits == 20) ? 1 : (s->bits == 24) ? 2 : 3;
+        ss->process = hdcd_kernels[1][!!ss->ana_mode][depth];
+    }
+}
+
+void _hdcd_process(hdcd_state *state, int32_t *samples, int count, int stride)
+{
+    state->process(state, samples, count, stride);
+}
+
+void _hdcd_process_stereo(hdcd_state_stereo *state, int32_t *samples, int count)
+{
+    state->process(state, samples, count, 2);
+}
+
+void _hdcd_process_stereo_float(hdcd_state_stereo *state, const int32_t *samples, float *fout, int count)
+{
+    /* not a kernel, the envelope is the same for every depth */
+    _hdcd_process_stereo_k(state, (int32_t*)samples, fout, count, 0, 0);
+}
+
+void _hdcd_float_in(const float *x, int32_t *s, int count, int bits)
+{
+    _hdcd_float_to_int(x, s, count, bits);
+}
+
+void _hdcd_float_out(const int32_t *s, float *x, int count)
+{
+    _hdcd_int_to_float(s, x, count);
+}
+
+/** the running gain after count samples of _hdcd_envelope(), without
+ *  touching any samples */
+int _hdcd_gain_run(int count, int gain, int target_gain)
+{
+    if (gain <= target_gain) {
+        gain += FFMIN(count, target_gain - gain);
+    } else {
+        gain -= FFMIN(count, (gain - target_gain) >> 3) * 8;
+        if (gain - 8 < target_gain)
+            gain = target_gain;
+    }
+    return gain;
+}
+
+void _hdcd_scan(hdcd_state *state, const int32_t *samples, int count, int stride)
+{
+    int full_count = count;
+    int gain = state->running_gain;
+    int peak_extend, target_gain;
+    int lead = 0;
+
+    _hdcd_control(state, &peak_extend, &target_gain);
+    while (count > lead) {
+        int envelope_run;
+        int run;
+
+        run = _hdcd_scan_x(state, 1, samples + lead * stride, count - lead, stride) + lead;
+        envelope_run = run - 1;
+        gain = _hdcd_gain_run(envelope_run, gain, target_gain);
+
+        samples += envelope_run * stride;
+        count -= envelope_run;
+        lead = run - envelope_run;
+        _hdcd_control(state, &peak_extend, &target_gain);
+    }
+    if (lead > 0)
+        gain = _hdcd_gain_run(lead, gain, target_gain);
+
+    state->running_gain = gain;
+    state->sample_count += full_count;
+}
+
+void _hdcd_timeline_free(hdcd_timeline *tl)
+{
+    if (!tl) return;
+    free(tl->change);
+    memset(tl, 0, sizeof(*tl));
+}
+
+int _hdcd_timeline_reserve(hdcd_timeline *tl, int64_t size)
+{
+    hdcd_change *change;
+    if (size <= tl->size) return 1;
+    if (size > INT_MAX / (int)sizeof(*change)) return 0;
+    change = realloc(tl->change, size * sizeof(*change));
+    if (!change) return 0;
+    tl->change = change;
+    tl->size = (int)size;
+    return 1;
+}
+
+/** add a run to the timeline, as _hdcd_change_add() */
+static void _hdcd_timeline_add(hdcd_timeline *tl, const hdcd_change *c)
+{
+    if (tl->count && _hdcd_change_same(&tl->change[tl->count - 1], c)) {
+        tl->change[tl->count - 1].count += c->count;
+        return;
+    }
+    if (tl->count == tl->size) {
+        int size = (tl->size) ? tl->size * 2 : 256;
+        hdcd_change *change = realloc(tl->change, size * sizeof(*change));
+        if (!change) {
+            tl->error = 1;
+            return;
+        }
+        tl->change = change;
+        tl->size = size;
+    }
+    tl->change[tl->count++] = *c;
+}
+
+void _hdcd_scan_stereo(hdcd_state_stereo *state, const int32_t *samples, int count)
+{
+    _hdcd_scan_stereo_timeline(state, samples, count, NULL);
+}
+
+void _hdcd_scan_stereo_timeline(hdcd_state_stereo *state, const int32_t *samples, int count, hdcd_timeline *tl)
+{
+    const int stride = 2;
+    int full_count = count;
+    int gain[2] = {state->channel[0].running_gain, state->channel[1].running_gain};
+    int peak_extend[2];
+    int lead = 0;
+    int ctlret;
+    hdcd_change c;
+
+    memset(&c, 0, sizeof(c));
+
+    ctlret = _hdcd_control_stereo(state, &peak_extend[0], &peak_extend[1]);
+    while (count > lead) {
+        int envelope_run, run;
+
+        run = _hdcd_scan_x(&state->channel[0], 2, (samples) ? samples + lead * stride : NULL, count - lead, 0) + lead;
+        envelope_run = run - 1;
+
+        if (ctlret == HDCD_TG_MISMATCH)
+            state->count_tg_mismatch += envelope_run;
+
+        gain[0] = _hdcd_gain_run(envelope_run, gain[0], state->val_target_gain);
+        gain[1] = _hdcd_gain_run(envelope_run, gain[1], state->val_target_gain);
+        if (tl) {
+            c.count = envelope_run;
+            c.target_gain = state->val_target_gain;
+            c.peak_extend[0] = peak_extend[0];
+            c.peak_extend[1] = peak_extend[1];
+            _hdcd_timeline_add(tl, &c);
+        }
+
+        if (samples) samples += envelope_run * stride;
+        count -= envelope_run;
+        lead = run - envelope_run;
+
+        ctlret = _hdcd_control_stereo(state, &peak_extend[0], &peak_extend[1]);
+    }
+    if (lead > 0) {
+        if (ctlret == HDCD_TG_MISMATCH)
+            state->count_tg_mismatch += lead;
+
+        gain[0] = _hdcd_gain_run(lead, gain[0], state->val_target_gain);
+        gain[1] = _hdcd_gain_run(lead, gain[1], state->val_target_gain);
+        if (tl) {
+            c.count = lead;
+            c.target_gain = state->val_target_gain;
+            c.peak_extend[0] = peak_extend[0];
+            c.peak_extend[1] = peak_extend[1];
+            _hdcd_timeline_add(tl, &c);
         }
     }
 
@@ -43,10 +43,12 @@
 
 #include <stdint.h>
 #include <stdarg.h>
+#include <stddef.h>
 
 #include "hdcd_libversion.h"
 #include "hdcd_detect.h"         /* enums for various detection values */
 #include "hdcd_analyze.h"        /* enums and definitions for analyze modes */
+#include "hdcd_events.h"         /* event types */
 
 #ifdef __cplusplus
 extern "C" {
@@ -70,11 +72,131 @@ void _hdcd_log(hdcd_log *log, const char* fmt, ...);
 void _hdcd_log_enable(hdcd_log *log);
 void _hdcd_log_disable(hdcd_log *log);
 
+/********************* optional events *************************/
+
+typedef struct {
+    uint32_t sid; /**< internal struct identity = HDCD_SID_EVENTS */
+
+    hdcd_event_callback func;   /**< optional callback */
+    void *priv;
+    hdcd_event *ring;           /**< optional caller-supplied ring buffer */
+    int size, head, count;
+    int lost;                   /**< events that didn't fit in the ring */
+} hdcd_events;
+
+int _hdcd_events_init(hdcd_events *ev);
+void _hdcd_event(hdcd_events *ev, int type, int channel, int64_t position, int control);
+/* take up to max events from the ring, returns the number taken */
+int _hdcd_events_read(hdcd_events *ev, hdcd_event *events, int max);
+
+/********************* optional lookup tables ******************/
+
+/** tables are only kept for the gains held between ramps, the
+ *  16 target_gain values, with and without peak extend */
+#define HDCD_LUT_MAX 32
+/** a table has an entry for every 16-bit sample */
+#define HDCD_LUT_SIZE 65536
+
+typedef struct {
+    int32_t *out;               /**< by sample + 0x8000 */
+    int gain, pe;
+    uint64_t used;              /**< clock of the last use */
+} hdcd_lut;
+
+/** the output of _hdcd_envelope() for 16-bit samples at a steady
+ *  gain, built when first needed, the least recently used dropped
+ *  when there are max */
+typedef struct {
+    uint32_t sid; /**< internal struct identity = HDCD_SID_LUTS */
+
+    hdcd_lut lut[HDCD_LUT_MAX];
+    int count, max;
+    uint64_t clock;
+    int hits, misses;
+} hdcd_luts;
+
+/* max is the number of tables that fit in max_bytes, up to HDCD_LUT_MAX */
+int _hdcd_luts_init(hdcd_luts *luts, size_t max_bytes);
+void _hdcd_luts_free(hdcd_luts *luts);
+
+/********************* scan record *****************************/
+
+/** where the scanner found a packet prefix (check = 0), or checked
+ *  the code that follows one (check = 1) */
+typedef struct {
+    int64_t position;
+    uint32_t wbits;
+    int channel;
+    int check;
+} hdcd_scan_mark;
+
+/** marks kept by a scan, so it can be replayed later from a
+ *  different state without the samples */
+typedef struct {
+    hdcd_scan_mark *mark;
+    int count, size;
+    int next;                   /**< the next mark to replay */
+    int error;                  /**< a mark couldn't be stored */
+} hdcd_scan_record;
+
+void _hdcd_scan_record_free(hdcd_scan_record *rec);
+
+/********************* LSB map *********************************/
+
+/** the LSBs of a stereo buffer packed ahead of the scan, with the
+ *  positions where a packet prefix ends, so the scan can take them in
+ *  place of packing and searching the samples itself, and skip from one
+ *  prefix to the next. Words are of 64 frames from start, the first
+ *  frame highest. Word k of channel c is at [k * stride + c * cstride],
+ *  and lsb[-stride] is the window before start. */
+typedef struct {
+    const int32_t *start;
+    const uint64_t *lsb;
+    const uint64_t *prefix;
+    int stride, cstride;
+} hdcd_lsb_map;
+
+/* map the buffers of n stereo streams, packed and searched side by
+ * side. window[2 * i + c] is the window of channel c of stream i.
+ * map[i] is set for each stream. returns the words the maps use, to
+ * free(), or NULL if there isn't the memory */
+uint64_t *_hdcd_lsb_map_streams(hdcd_lsb_map *map, const int32_t *const *samples, const int *count, const uint64_t *window, int n, int shift);
+
+/********************* control timeline ************************/
+
+/** a run of samples under one control, where the scan stopped.
+ *  sustain and tgm are only for analyze mode */
+typedef struct {
+    int count;
+    int target_gain;
+    int peak_extend[2];
+    unsigned sustain[2];
+    int tgm;
+} hdcd_change;
+
+/** the runs of a stereo scan, one after another, so they can be
+ *  applied later, or in parts */
+typedef struct {
+    hdcd_change *change;
+    int count, size;
+    int error;                  /**< a run couldn't be stored */
+} hdcd_timeline;
+
+void _hdcd_timeline_free(hdcd_timeline *tl);
+/* make room for size runs, so adding that many can't fail.
+ * returns 0 if there isn't the memory */
+int _hdcd_timeline_reserve(hdcd_timeline *tl, int64_t size);
+
 /********************* decoding ********************************/
 
 #define HDCD_FLAG_FORCE_PE         128
 #define HDCD_FLAG_TGM_LOG_OFF       64
 
+/** _hdcd_process() or _hdcd_process_stereo() built for one bit depth
+ *  and analyze mode. state is hdcd_state* or hdcd_state_stereo*, and
+ *  stride isn't used in stereo */
+typedef void hdcd_kernel(void *state, int32_t *samples, int count, int stride);
+
 typedef struct {
     uint32_t sid; /**< internal struct identity = HDCD_SID_STATE */
 
@@ -95,6 +217,7 @@ typedef struct {
     int running_gain; /**< 11-bit (3.8) fixed point, extended from target_gain */
 
     int bits;             /**< sample bit depth: 16, 20, 24 */
+    int lsb_shift;        /**< the sample bit scanned for packets, normally 0 */
     int rate;             /**< sample rate */
     int cdt_period;       /**< cdt period in ms */
 
@@ -119,8 +242,15 @@ typedef struct {
 
     hdcd_log *log;              /**< optional logging */
     int sample_count;           /**< used in logging  */
+    hdcd_events *events;        /**< optional events  */
+    int64_t position;           /**< samples scanned, used in events */
+    int channel;                /**< used in events   */
+    hdcd_scan_record *record;   /**< optional scan record */
+    const hdcd_lsb_map *map;    /**< optional LSB map, stereo only */
+    hdcd_luts *luts;            /**< optional lookup tables, 16-bit only */
     hdcd_ana_mode ana_mode;     /**< analyze mode     */
     int _ana_snb;               /**< used in the analyze mode tone generator */
+    hdcd_kernel *process;       /**< picked for bits and ana_mode */
 
 } hdcd_state;
 
@@ -131,18 +261,42 @@ typedef struct {
     hdcd_ana_mode ana_mode;     /**< analyze mode                    */
     int val_target_gain;        /**< last valid matching target_gain */
     int count_tg_mismatch;      /**< target_gain mismatch samples  */
+    int tgm_event;              /**< target_gains of the last mismatch event, -1 for none */
+    hdcd_kernel *process;       /**< picked for bits and ana_mode    */
 } hdcd_state_stereo;
 
 /* n-channel versions */
 void _hdcd_reset(hdcd_state *state, unsigned rate, unsigned bits, int sustain_period_ms, int flags);
 void _hdcd_process(hdcd_state *state, int *samples, int count, int stride);
+/* as _hdcd_process(), but samples are only scanned, not changed.
+ * state is updated the same way, except for the analyze mode tone. */
+void _hdcd_scan(hdcd_state *state, const int *samples, int count, int stride);
 
 /* stereo versions */
 void _hdcd_reset_stereo(hdcd_state_stereo *state, unsigned rate, unsigned bits, int sustain_period_ms, int flags);
 void _hdcd_process_stereo(hdcd_state_stereo *state, int *samples, int count);
+/* samples = NULL replays the marks in channel[0].record instead */
+void _hdcd_scan_stereo(hdcd_state_stereo *state, const int *samples, int count);
+/* as _hdcd_scan_stereo(), and add the runs to tl */
+void _hdcd_scan_stereo_timeline(hdcd_state_stereo *state, const int *samples, int count, hdcd_timeline *tl);
+/* decode n runs of a timeline from gain[], not in analyze mode. gain[]
+ * is updated. The tables attached to state are used */
+void _hdcd_apply_stereo(hdcd_state_stereo *state, int *samples, const hdcd_change *list, int n, int *gain);
+/* as _hdcd_process_stereo(), but the envelope is done in float and the
+ * decoded samples written to fout, 1.0 for a 32-bit full scale.
+ * samples are only read. Not in analyze mode, tables aren't used */
+void _hdcd_process_stereo_float(hdcd_state_stereo *state, const int *samples, float *fout, int count);
+/* float samples, 1.0 full scale, to integers of bits, and 32-bit
+ * integers back to float */
+void _hdcd_float_in(const float *x, int *s, int count, int bits);
+void _hdcd_float_out(const int *s, float *x, int count);
+/* the running gain after count samples of a run toward target_gain */
+int _hdcd_gain_run(int count, int gain, int target_gain);
 
 /* hdcd_state* or hdcd_state_stereo* */
 void _hdcd_attach_logger(void *state, hdcd_log *log); /* log = NULL to use the default logger */
+void _hdcd_attach_events(void *state, hdcd_events *ev); /* ev = NULL for none */
+void _hdcd_attach_luts(void *state, hdcd_luts *luts); /* luts = NULL for none */
 void _hdcd_set_analyze_mode(void *state, hdcd_ana_mode mode);
 
 
@@ -0,0 +1,68 @@
+/*
+ *  Copyright (C) 2016, Burt P.,
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification,
+ *  are permitted provided that the following conditions are met:
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *    3. The names of its contributors may not be used to endorse or promote
+ *       products derived from this software without specific prior written
+ *       permission.
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _HDCD_EVENTS_H_
+#define _HDCD_EVENTS_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Events
+ *
+ *   Reported as they are found while scanning, so an application can
+ *   see where packets occur and what they do, without parsing the log.
+ */
+
+typedef enum {
+    HDCD_EVENT_PACKET      = 0, /**< valid packet, control is the new control code */
+    HDCD_EVENT_ALMOST_A    = 1, /**< looks like an A packet, but a bit expected to be 0 is 1 */
+    HDCD_EVENT_CHECKFAIL_B = 2, /**< looks like a B packet, but doesn't pass the XOR check */
+    HDCD_EVENT_CDT_EXPIRED = 3, /**< code detect timer expired, control is the code that expired */
+    HDCD_EVENT_TG_MISMATCH = 4, /**< target_gain differs between channels, control is this channel's */
+} hdcd_event_type;
+
+typedef struct {
+    int64_t position;    /**< sample (per channel) since the last reset */
+    int type;            /**< see hdcd_event_type */
+    int channel;         /**< 0 or 1 */
+    int control;         /**< control code, for errors: the code as found */
+} hdcd_event;
+
+typedef void (*hdcd_event_callback)(const void *priv, const hdcd_event *event);
+
+/** get a string describing an event type */
+const char* hdcd_str_event(hdcd_event_type v);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -32,9 +32,9 @@
 extern "C" {
 #endif
 
-#define HDCDLIB_VER_MAJOR 1  /* used as libtool 'current'  */
-#define HDCDLIB_VER_MINOR 4  /* used as libtool 'revision' */
-#define HDCDLIB_VER_AGE   0  /* used as libtool 'age'      */
+#define HDCDLIB_VER_MAJOR 2  /* used as libtool 'current'  */
+#define HDCDLIB_VER_MINOR 0  /* used as libtool 'revision' */
+#define HDCDLIB_VER_AGE   1  /* used as libtool 'age'      */
 /* age is the difference between the 'current' and whatever
  * old 'current' version the library can still safely link against.
  * https://www.gnu.org/software/libtool/manual/html_node/Libtool-versioning.html */
@@ -0,0 +1,649 @@
+/*
+ *  Copyright (C) 2016, Burt P.,
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification,
+ *  are permitted provided that the following conditions are met:
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *    3. The names of its contributors may not be used to endorse or promote
+ *       products derived from this software without specific prior written
+ *       permission.
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* #included in hdcd_decode2.c */
+
+/* Vectorized helpers. Each has a plain C version that is used when the
+ * compiler doesn't target the instruction set, and is the reference
+ * for the results of the others. */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/** used in _hdcd_lsb_pack() */
+#define HDCD_LSB_WORD 64
+
+/** pack the LSBs (bit shift) of count (<= HDCD_LSB_WORD) samples from each
+ *  channel into a word per channel. The first sample is in the most
+ *  significant of the count bits used, the same order they are shifted into
+ *  hdcd_state.window */
+static void _hdcd_lsb_pack(uint64_t *lsb, int channels, const int32_t *samples, int count, int stride, int shift)
+{
+    int i, j = 0;
+
+    if (channels == 2 && stride == 2) {
+        /* kept in locals, the vector loads may alias lsb[] */
+        uint64_t l0 = 0, l1 = 0;
+#if defined(__AVX2__)
+        /* after packing down to bytes and swapping the middle quarters,
+         * each lane holds eight frames as L R pairs in the frame order
+         * 0 1 4 5 2 3 6 7. Reorder them to L7..L0 R7..R0, so movemask
+         * gives the bits with the first frame highest. */
+        const __m256i order = _mm256_setr_epi8(
+            14, 12, 6, 4, 10, 8, 2, 0, 15, 13, 7, 5, 11, 9, 3, 1,
+            14, 12, 6, 4, 10, 8, 2, 0, 15, 13, 7, 5, 11, 9, 3, 1);
+        const __m128i top = _mm_cvtsi32_si128(31 - shift);
+        for (; j + 16 <= count; j += 16) {
+            const __m256i *in = (const __m256i*)(samples + j * 2);
+            __m256i a = _mm256_sll_epi32(_mm256_loadu_si256(in), top);
+            __m256i b = _mm256_sll_epi32(_mm256_loadu_si256(in + 1), top);
+            __m256i c = _mm256_sll_epi32(_mm256_loadu_si256(in + 2), top);
+            __m256i d = _mm256_sll_epi32(_mm256_loadu_si256(in + 3), top);
+            __m256i v = _mm256_packs_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+            uint32_t m;
+            v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+            m = (uint32_t)_mm256_movemask_epi8(_mm256_shuffle_epi8(v, order));
+            l0 = (l0 << 16) | ((m & 0xff) << 8) | ((m >> 16) & 0xff);
+            l1 = (l1 << 16) | (m & 0xff00) | (m >> 24);
+        }
+#elif defined(__SSE2__)
+        const __m128i top = _mm_cvtsi32_si128(31 - shift);
+        for (; j + 8 <= count; j += 8) {
+            const __m128i *in = (const __m128i*)(samples + j * 2);
+            __m128 a = _mm_castsi128_ps(_mm_sll_epi32(_mm_loadu_si128(in), top));
+            __m128 b = _mm_castsi128_ps(_mm_sll_epi32(_mm_loadu_si128(in + 1), top));
+            __m128 c = _mm_castsi128_ps(_mm_sll_epi32(_mm_loadu_si128(in + 2), top));
+            __m128 d = _mm_castsi128_ps(_mm_sll_epi32(_mm_loadu_si128(in + 3), top));
+            /* a = [L0 R0 L1 R1], b = [L2 R2 L3 R3] -> [L3 L2 L1 L0], [R3 R2 R1 R0],
+             * then pack down to bytes [L7 .. L0 R7 .. R0] */
+            __m128i l = _mm_packs_epi32(
+                _mm_castps_si128(_mm_shuffle_ps(d, c, _MM_SHUFFLE(0, 2, 0, 2))),
+                _mm_castps_si128(_mm_shuffle_ps(b, a, _MM_SHUFFLE(0, 2, 0, 2))) );
+            __m128i r = _mm_packs_epi32(
+                _mm_castps_si128(_mm_shuffle_ps(d, c, _MM_SHUFFLE(1, 3, 1, 3))),
+                _mm_castps_si128(_mm_shuffle_ps(b, a, _MM_SHUFFLE(1, 3, 1, 3))) );
+            uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(l, r));
+            l0 = (l0 << 8) | (m & 0xff);
+            l1 = (l1 << 8) | (m >> 8);
+        }
+#endif
+        for (; j < count; j++) {
+            l0 = (l0 << 1) | (samples[j * 2] >> shift & 1);
+            l1 = (l1 << 1) | (samples[j * 2 + 1] >> shift & 1);
+        }
+        lsb[0] = l0;
+        lsb[1] = l1;
+        return;
+    }
+
+    for (i = 0; i < channels; i++)
+        lsb[i] = 0;
+    for (; j < count; j++) {
+        for (i = 0; i < channels; i++)
+            lsb[i] = (lsb[i] << 1) | (samples[i] >> shift & 1);
+        samples += stride;
+    }
+}
+
+/** mark the positions in a word from _hdcd_lsb_pack() where the top byte of
+ *  window ^ window >> 5 ^ window >> 23 would be 0x7e, the first byte of a
+ *  packet prefix, for each channel. Only these few need a full check.
+ *
+ *  The stream is taken as u = window:lsb, and v = u ^ u >> 5 ^ u >> 23,
+ *  so the top byte can be tested at every position at once, a bit at a
+ *  time. The vector versions do two or four channels side by side. A
+ *  batch scan passes the words of many streams as the channels. */
+static void _hdcd_prefix_candidates(uint64_t *m, int channels, const uint64_t *window, const uint64_t *lsb, int count)
+{
+    const uint64_t used = ~(uint64_t)0 << (HDCD_LSB_WORD - count);
+    int i = 0;
+
+#if defined(__AVX2__)
+    {
+        const __m128i up = _mm_cvtsi32_si128(HDCD_LSB_WORD - count);
+        const __m256i used4 = _mm256_set1_epi64x((long long)used);
+        for (; i + 4 <= channels; i += 4) {
+            __m256i w = _mm256_loadu_si256((const __m256i*)(window + i));
+            __m256i lo = _mm256_sll_epi64(_mm256_loadu_si256((const __m256i*)(lsb + i)), up);
+            __m256i vhi = _mm256_xor_si256(w, _mm256_xor_si256(_mm256_srli_epi64(w, 5), _mm256_srli_epi64(w, 23)));
+            __m256i vlo = _mm256_xor_si256(lo, _mm256_xor_si256(
+                _mm256_or_si256(_mm256_srli_epi64(lo, 5), _mm256_slli_epi64(w, 59)),
+                _mm256_or_si256(_mm256_srli_epi64(lo, 23), _mm256_slli_epi64(w, 41)) ));
+            __m256i v;
+#define VBITS(b) _mm256_or_si256(_mm256_srli_epi64(vlo, b), _mm256_slli_epi64(vhi, 64 - (b)))
+            v = _mm256_and_si256(_mm256_and_si256(VBITS(30), VBITS(29)), _mm256_and_si256(VBITS(28), VBITS(27)));
+            v = _mm256_and_si256(v, _mm256_and_si256(VBITS(26), VBITS(25)));
+            v = _mm256_andnot_si256(_mm256_or_si256(VBITS(31), VBITS(24)), v);
+#undef VBITS
+            _mm256_storeu_si256((__m256i*)(m + i), _mm256_and_si256(v, used4));
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i up = _mm_cvtsi32_si128(HDCD_LSB_WORD - count);
+        for (; i + 2 <= channels; i += 2) {
+            __m128i w = _mm_loadu_si128((const __m128i*)(window + i));
+            __m128i lo = _mm_sll_epi64(_mm_loadu_si128((const __m128i*)(lsb + i)), up);
+            __m128i vhi = _mm_xor_si128(w, _mm_xor_si128(_mm_srli_epi64(w, 5), _mm_srli_epi64(w, 23)));
+            __m128i vlo = _mm_xor_si128(lo, _mm_xor_si128(
+                _mm_or_si128(_mm_srli_epi64(lo, 5), _mm_slli_epi64(w, 59)),
+                _mm_or_si128(_mm_srli_epi64(lo, 23), _mm_slli_epi64(w, 41)) ));
+            __m128i v;
+            /* bit b of v at every position */
+#define VBITS(b) _mm_or_si128(_mm_srli_epi64(vlo, b), _mm_slli_epi64(vhi, 64 - (b)))
+            v = _mm_and_si128(_mm_and_si128(VBITS(30), VBITS(29)), _mm_and_si128(VBITS(28), VBITS(27)));
+            v = _mm_and_si128(v, _mm_and_si128(VBITS(26), VBITS(25)));
+            v = _mm_andnot_si128(_mm_or_si128(VBITS(31), VBITS(24)), v);
+#undef VBITS
+            _mm_storeu_si128((__m128i*)(m + i), v);
+            m[i] &= used;
+            m[i + 1] &= used;
+        }
+    }
+#endif
+    for (; i < channels; i++) {
+        uint64_t lo = lsb[i] << (HDCD_LSB_WORD - count);
+        uint64_t vhi = window[i] ^ window[i] >> 5 ^ window[i] >> 23;
+        uint64_t vlo = lo ^ (lo >> 5 | window[i] << 59) ^ (lo >> 23 | window[i] << 41);
+#define VBITS(b) (vlo >> (b) | vhi << (64 - (b)))
+        m[i] = used & ~VBITS(31) & VBITS(30) & VBITS(29) & VBITS(28)
+            & VBITS(27) & VBITS(26) & VBITS(25) & ~VBITS(24);
+#undef VBITS
+    }
+}
+
+/** count leading zeros, x must not be 0 */
+static inline int _hdcd_clz64(uint64_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+    while (!(x & ((uint64_t)1 << 63))) { x <<= 1; n++; }
+    return n;
+#endif
+}
+
+/** count the leading samples (up to count) where the LSB (bit shift) is 0
+ *  in every channel. Used to skip over digital silence. */
+static int _hdcd_lsb_zero_run(const int32_t *samples, int channels, int count, int stride, int shift)
+{
+    int i, j = 0;
+    const int32_t bit = 1 << shift;
+
+    if (channels == stride) {
+        /* contiguous, so just look for the first odd value */
+        int n = count * channels;
+#if defined(__AVX2__)
+        const __m256i mask = _mm256_set1_epi32(bit);
+        const __m256i *in = (const __m256i*)samples;
+        for (; j + 32 <= n; j += 32, in += 4) {
+            __m256i v = _mm256_or_si256(
+                _mm256_or_si256(_mm256_loadu_si256(in), _mm256_loadu_si256(in + 1)),
+                _mm256_or_si256(_mm256_loadu_si256(in + 2), _mm256_loadu_si256(in + 3)) );
+            if (!_mm256_testz_si256(v, mask)) break;
+        }
+#elif defined(__SSE2__)
+        const __m128i mask = _mm_set1_epi32(bit);
+        const __m128i *in = (const __m128i*)samples;
+        for (; j + 16 <= n; j += 16, in += 4) {
+            __m128i v = _mm_or_si128(
+                _mm_or_si128(_mm_loadu_si128(in), _mm_loadu_si128(in + 1)),
+                _mm_or_si128(_mm_loadu_si128(in + 2), _mm_loadu_si128(in + 3)) );
+            v = _mm_cmpeq_epi32(_mm_and_si128(v, mask), _mm_setzero_si128());
+            if (_mm_movemask_epi8(v) != 0xffff) break;
+        }
+#endif
+        while (j < n && !(samples[j] & bit)) j++;
+        return j / channels;
+    }
+
+    for (; j < count; j++) {
+        for (i = 0; i < channels; i++)
+            if (samples[i] & bit) return j;
+        samples += stride;
+    }
+    return j;
+}
+
+/** samples[i * stride] <<= shift, for count samples */
+static void _hdcd_shift_run(int32_t *samples, int count, int stride, int shift)
+{
+    int i = 0;
+
+    if (stride == 1) {
+        /* both channels of interlaced stereo at once */
+#if defined(__AVX2__)
+        const __m128i n = _mm_cvtsi32_si128(shift);
+        for (; i + 8 <= count; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(samples + i));
+            _mm256_storeu_si256((__m256i*)(samples + i), _mm256_sll_epi32(v, n));
+        }
+#elif defined(__SSE2__)
+        const __m128i n = _mm_cvtsi32_si128(shift);
+        for (; i + 4 <= count; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(samples + i));
+            _mm_storeu_si128((__m128i*)(samples + i), _mm_sll_epi32(v, n));
+        }
+#endif
+    } else if (stride == 2) {
+        /* one channel of interlaced stereo is in the even lanes. The odd
+         * lanes, the other channel, are stored back as they were, and the
+         * last load can't reach past the last sample of this channel. */
+#if defined(__AVX2__)
+        const __m128i n = _mm_cvtsi32_si128(shift);
+        for (; i + 5 <= count; i += 4) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(samples + i * 2));
+            _mm256_storeu_si256((__m256i*)(samples + i * 2),
+                _mm256_blend_epi32(_mm256_sll_epi32(v, n), v, 0xaa) );
+        }
+#elif defined(__SSE2__)
+        const __m128i n = _mm_cvtsi32_si128(shift);
+        const __m128i even = _mm_set_epi32(0, -1, 0, -1);
+        for (; i + 3 <= count; i += 2) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(samples + i * 2));
+            _mm_storeu_si128((__m128i*)(samples + i * 2), _mm_or_si128(
+                _mm_and_si128(_mm_sll_epi32(v, n), even), _mm_andnot_si128(even, v)) );
+        }
+#endif
+    }
+    for (; i < count; i++)
+        samples[i * stride] <<= shift;
+}
+
+/** the steady level of _hdcd_envelope(), as APPLY_GAIN for count
+ *  samples, with g from gaintab[] */
+static void _hdcd_gain_hold(int32_t *samples, int count, int stride, int32_t g)
+{
+    int i = 0;
+
+    if (stride == 2) {
+        /* even lanes, as in _hdcd_shift_run(). Only the low 32 bits of
+         * the product >> 23 are kept, so a 64-bit logical shift does */
+#if defined(__AVX2__)
+        const __m256i vg = _mm256_set1_epi32(g);
+        for (; i + 5 <= count; i += 4) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(samples + i * 2));
+            __m256i p = _mm256_srli_epi64(_mm256_mul_epi32(v, vg), 23);
+            _mm256_storeu_si256((__m256i*)(samples + i * 2), _mm256_blend_epi32(p, v, 0xaa));
+        }
+#elif defined(__SSE2__)
+        const __m128i vg = _mm_set1_epi32(g);
+        const __m128i even = _mm_set_epi32(0, -1, 0, -1);
+        for (; i + 3 <= count; i += 2) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(samples + i * 2));
+            /* the multiply is unsigned, g is positive, so the high
+             * half is g too much where the sample is negative */
+            __m128i p = _mm_mul_epu32(v, vg);
+            p = _mm_sub_epi64(p, _mm_slli_epi64(_mm_and_si128(_mm_srai_epi32(v, 31), vg), 32));
+            p = _mm_srli_epi64(p, 23);
+            _mm_storeu_si128((__m128i*)(samples + i * 2), _mm_or_si128(
+                _mm_and_si128(p, even), _mm_andnot_si128(even, v)) );
+        }
+#endif
+    }
+    for (; i < count; i++) {
+        int64_t s64 = samples[i * stride];
+        samples[i * stride] = (int32_t)(s64 * g >> 23);
+    }
+}
+
+/** the gain ramp of _hdcd_envelope(), as APPLY_GAIN for count samples,
+ *  the gain moving by step before each. The coefficients for a vector
+ *  of samples are a slice of gaintab[], read straight from it when the
+ *  step is 1, attenuating. SSE2 only has room for two samples, and
+ *  isn't quicker than plain C for a ramp */
+static void _hdcd_gain_ramp(int32_t *samples, int count, int stride, int gain, int step)
+{
+    int i = 0;
+
+#if defined(__AVX2__)
+    if (stride == 2) {
+        /* even lanes and the multiply, as in _hdcd_gain_hold() */
+        for (; i + 5 <= count; i += 4) {
+            const int32_t *gt = gaintab + gain + i * step;
+            __m128i g4 = (step == 1)
+                ? _mm_loadu_si128((const __m128i*)(gt + 1))
+                : _mm_setr_epi32(gt[step], gt[step * 2], gt[step * 3], gt[step * 4]);
+            __m256i vg = _mm256_cvtepu32_epi64(g4);
+            __m256i v = _mm256_loadu_si256((const __m256i*)(samples + i * 2));
+            __m256i p = _mm256_srli_epi64(_mm256_mul_epi32(v, vg), 23);
+            _mm256_storeu_si256((__m256i*)(samples + i * 2), _mm256_blend_epi32(p, v, 0xaa));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        int64_t s64 = samples[i * stride];
+        samples[i * stride] = (int32_t)(s64 * gaintab[gain + (i + 1) * step] >> 23);
+    }
+}
+
+#if defined(__AVX2__)
+/** PEAKTAB() of the lanes in pe, signed as v. a is abs(v) - pe_level */
+static inline __m256i _hdcd_peaktab_x8(__m256i v, __m256i a, __m256i max, __m256i pe)
+{
+#if HDCD_COMPACT_PEAKTAB
+    /* base, then step | knee << 16 | adj << 24 of each block */
+    __m256i x = _mm256_min_epi32(a, max);
+    __m256i b = _mm256_srli_epi32(x, 6), k = _mm256_and_si256(x, _mm256_set1_epi32(63));
+    __m256i t = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+        (const int*)pe_block, b, pe, 8);
+    __m256i u = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+        (const int*)pe_block + 1, b, pe, 8);
+    __m256i knee = _mm256_and_si256(_mm256_srli_epi32(u, 16), _mm256_set1_epi32(0xff));
+    t = _mm256_add_epi32(t, _mm256_mullo_epi32(k, _mm256_and_si256(u, _mm256_set1_epi32(0xffff))));
+    t = _mm256_add_epi32(t, _mm256_and_si256(_mm256_srai_epi32(u, 24), _mm256_cmpgt_epi32(k, knee)));
+    t = _mm256_slli_epi32(t, 8);
+#else
+    __m256i t = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+        (const int*)peaktab, _mm256_min_epi32(a, max), pe, 4);
+#endif
+    return _mm256_sign_epi32(t, v);
+}
+#endif
+
+/** the peak extend of _hdcd_envelope(): samples at or above pe_level
+ *  are expanded with PEAKTAB(), the rest are shifted left by shift */
+static void _hdcd_peak_extend_run(int32_t *samples, int count, int stride, int pe_level, int shift)
+{
+    int i = 0;
+
+    if (stride == 2) {
+        /* even lanes, as in _hdcd_shift_run(). Most samples are below
+         * the level, so the table is only visited when one isn't. */
+#if defined(__AVX2__)
+        const __m128i n = _mm_cvtsi32_si128(shift);
+        const __m256i level = _mm256_set1_epi32(pe_level);
+        const __m256i max = _mm256_set1_epi32(pe_max_asample);
+        const __m256i even = _mm256_setr_epi32(-1, 0, -1, 0, -1, 0, -1, 0);
+        for (; i + 5 <= count; i += 4) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(samples + i * 2));
+            __m256i a = _mm256_sub_epi32(_mm256_abs_epi32(v), level);
+            __m256i pe = _mm256_and_si256(_mm256_cmpgt_epi32(a, _mm256_set1_epi32(-1)), even);
+            __m256i r = _mm256_sll_epi32(v, n);
+            if (!_mm256_testz_si256(pe, pe))
+                r = _mm256_blendv_epi8(r, _hdcd_peaktab_x8(v, a, max, pe), pe);
+            _mm256_storeu_si256((__m256i*)(samples + i * 2), _mm256_blend_epi32(r, v, 0xaa));
+        }
+#elif defined(__SSE2__)
+        const __m128i n = _mm_cvtsi32_si128(shift);
+        const __m128i level = _mm_set1_epi32(pe_level);
+        const __m128i even = _mm_set_epi32(0, -1, 0, -1);
+        for (; i + 3 <= count; i += 2) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(samples + i * 2));
+            __m128i sign = _mm_srai_epi32(v, 31);
+            __m128i a = _mm_sub_epi32(_mm_sub_epi32(_mm_xor_si128(v, sign), sign), level);
+            int pe = _mm_movemask_ps(_mm_castsi128_ps(_mm_andnot_si128(a, even)));
+            _mm_storeu_si128((__m128i*)(samples + i * 2), _mm_or_si128(
+                _mm_and_si128(_mm_sll_epi32(v, n), even), _mm_andnot_si128(even, v)) );
+            /* no gather, the few that need the table are done one by one */
+            if (pe & 1) {
+                int32_t s = _mm_cvtsi128_si32(v), as = abs(s) - pe_level;
+                if (as > pe_max_asample) as = pe_max_asample;
+                samples[i * 2] = (s >= 0) ? PEAKTAB(as) : -PEAKTAB(as);
+            }
+            if (pe & 4) {
+                int32_t s = _mm_cvtsi128_si32(_mm_srli_si128(v, 8)), as = abs(s) - pe_level;
+                if (as > pe_max_asample) as = pe_max_asample;
+                samples[i * 2 + 2] = (s >= 0) ? PEAKTAB(as) : -PEAKTAB(as);
+            }
+        }
+#endif
+    }
+    for (; i < count; i++) {
+        int32_t sample = samples[i * stride];
+        int32_t asample = abs(sample) - pe_level;
+        if (asample >= 0) {
+            if (asample > pe_max_asample) asample = pe_max_asample;
+            sample = sample >= 0 ? PEAKTAB(asample) : -PEAKTAB(asample);
+        } else
+            sample <<= shift;
+        samples[i * stride] = sample;
+    }
+}
+
+/** _hdcd_peak_extend_run() of count frames of interlaced stereo in one
+ *  pass, each channel only if its extend is set, otherwise shifted */
+static void _hdcd_peak_extend_stereo(int32_t *samples, int count, int extend0, int extend1, int pe_level, int shift)
+{
+    int i = 0, c;
+
+#if defined(__AVX2__)
+    const __m128i n = _mm_cvtsi32_si128(shift);
+    const __m256i level = _mm256_set1_epi32(pe_level);
+    const __m256i max = _mm256_set1_epi32(pe_max_asample);
+    const __m256i lanes = _mm256_setr_epi32(-!!extend0, -!!extend1, -!!extend0, -!!extend1,
+                                            -!!extend0, -!!extend1, -!!extend0, -!!extend1);
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(samples + i * 2));
+        __m256i a = _mm256_sub_epi32(_mm256_abs_epi32(v), level);
+        __m256i pe = _mm256_and_si256(_mm256_cmpgt_epi32(a, _mm256_set1_epi32(-1)), lanes);
+        __m256i r = _mm256_sll_epi32(v, n);
+        if (!_mm256_testz_si256(pe, pe))
+            r = _mm256_blendv_epi8(r, _hdcd_peaktab_x8(v, a, max, pe), pe);
+        _mm256_storeu_si256((__m256i*)(samples + i * 2), r);
+    }
+#elif defined(__SSE2__)
+    const __m128i n = _mm_cvtsi32_si128(shift);
+    const __m128i level = _mm_set1_epi32(pe_level);
+    const int lanes = (extend0 ? 5 : 0) | (extend1 ? 10 : 0);
+    for (; i + 2 <= count; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(samples + i * 2));
+        __m128i sign = _mm_srai_epi32(v, 31);
+        __m128i a = _mm_sub_epi32(_mm_sub_epi32(_mm_xor_si128(v, sign), sign), level);
+        int pe = ~_mm_movemask_ps(_mm_castsi128_ps(a)) & lanes;
+        _mm_storeu_si128((__m128i*)(samples + i * 2), _mm_sll_epi32(v, n));
+        /* the few that need the table are done one by one */
+        if (pe) {
+            int32_t s[4];
+            _mm_storeu_si128((__m128i*)s, v);
+            for (c = 0; c < 4; c++) {
+                if (pe & (1 << c)) {
+                    int32_t as = abs(s[c]) - pe_level;
+                    if (as > pe_max_asample) as = pe_max_asample;
+                    samples[i * 2 + c] = (s[c] >= 0) ? PEAKTAB(as) : -PEAKTAB(as);
+                }
+            }
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        for (c = 0; c < 2; c++) {
+            int32_t sample = samples[i * 2 + c];
+            int32_t asample = abs(sample) - pe_level;
+            if ((c ? extend1 : extend0) && asample >= 0) {
+                if (asample > pe_max_asample) asample = pe_max_asample;
+                sample = sample >= 0 ? PEAKTAB(asample) : -PEAKTAB(asample);
+            } else
+                sample <<= shift;
+            samples[i * 2 + c] = sample;
+        }
+    }
+}
+
+/** _hdcd_gain_hold() of count frames of interlaced stereo in one pass,
+ *  g0 and g1 for each channel */
+static void _hdcd_gain_hold_stereo(int32_t *samples, int count, int32_t g0, int32_t g1)
+{
+    int i = 0;
+
+#if defined(__AVX2__)
+    /* each product is the low 32 bits of >> 23, for the odd lanes
+     * that is << 9 in the high half */
+    const __m256i vg0 = _mm256_set1_epi32(g0), vg1 = _mm256_set1_epi32(g1);
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(samples + i * 2));
+        __m256i p0 = _mm256_srli_epi64(_mm256_mul_epi32(v, vg0), 23);
+        __m256i p1 = _mm256_slli_epi64(_mm256_mul_epi32(_mm256_srli_epi64(v, 32), vg1), 9);
+        _mm256_storeu_si256((__m256i*)(samples + i * 2), _mm256_blend_epi32(p0, p1, 0xaa));
+    }
+#endif
+    for (; i < count; i++) {
+        int64_t s0 = samples[i * 2], s1 = samples[i * 2 + 1];
+        samples[i * 2] = (int32_t)(s0 * g0 >> 23);
+        samples[i * 2 + 1] = (int32_t)(s1 * g1 >> 23);
+    }
+}
+
+/* The float path of hdcd_process_float(). 1.0 is a 32-bit full scale
+ * sample, so the output is what the integer path would give, scaled.
+ * The integers are still what is scanned and what picks the samples
+ * to peak extend, only the envelope is done in float. */
+
+/** a 32-bit sample of 1, as a float */
+#define HDCD_FLOAT_LSB32 (1.0f / 2147483648.0f)
+/** gaintab[g] as a float, 1.0 at 0 dB */
+#define HDCD_FLOAT_GAIN(g) ((float)gaintab[g] * (1.0f / 8388608.0f))
+
+/** s[i] = x[i] as a sample of bits, truncated and clipped to the range
+ *  of bits, NaN to the most negative. Float samples of a 16-bit or
+ *  24-bit source are whole numbers here, so nothing is lost */
+static void _hdcd_float_to_int(const float *x, int32_t *s, int count, int bits)
+{
+    const float scale = (float)(1 << (bits - 1));
+    int i = 0;
+
+#if defined(__AVX2__)
+    const __m256 vs = _mm256_set1_ps(scale), lo = _mm256_set1_ps(-scale), hi = _mm256_set1_ps(scale - 1);
+    for (; i + 8 <= count; i += 8) {
+        /* max returns its second operand for a NaN */
+        __m256 v = _mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(x + i), vs), lo);
+        _mm256_storeu_si256((__m256i*)(s + i), _mm256_cvttps_epi32(_mm256_min_ps(v, hi)));
+    }
+#elif defined(__SSE2__)
+    const __m128 vs = _mm_set1_ps(scale), lo = _mm_set1_ps(-scale), hi = _mm_set1_ps(scale - 1);
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_max_ps(_mm_mul_ps(_mm_loadu_ps(x + i), vs), lo);
+        _mm_storeu_si128((__m128i*)(s + i), _mm_cvttps_epi32(_mm_min_ps(v, hi)));
+    }
+#endif
+    for (; i < count; i++) {
+        float v = x[i] * scale;
+        if (!(v >= -scale)) v = -scale;
+        if (v > scale - 1) v = scale - 1;
+        s[i] = (int32_t)v;
+    }
+}
+
+/** x[i] = s[i], a 32-bit sample, as a float */
+static void _hdcd_int_to_float(const int32_t *s, float *x, int count)
+{
+    int i = 0;
+
+#if defined(__AVX2__)
+    const __m256 one = _mm256_set1_ps(HDCD_FLOAT_LSB32);
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(x + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(s + i))), one));
+#elif defined(__SSE2__)
+    const __m128 one = _mm_set1_ps(HDCD_FLOAT_LSB32);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(x + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(s + i))), one));
+#endif
+    for (; i < count; i++)
+        x[i] = (float)s[i] * HDCD_FLOAT_LSB32;
+}
+
+/** a float sample before the gain: x shifted to 32 bits, which is half
+ *  of it, or PEAKTAB() when extend is set and s, the same sample as an
+ *  integer, is at or above pe_level */
+static inline float _hdcd_float_base(float x, int32_t s, int extend, int pe_level)
+{
+    int32_t asample = abs(s) - pe_level;
+    if (extend && asample >= 0) {
+        int32_t sample;
+        if (asample > pe_max_asample) asample = pe_max_asample;
+        sample = s >= 0 ? PEAKTAB(asample) : -PEAKTAB(asample);
+        return (float)sample * HDCD_FLOAT_LSB32;
+    }
+    return x * 0.5f;
+}
+
+/** _hdcd_float_base() of count samples of one channel of interlaced
+ *  stereo, times the gain of _hdcd_gain_ramp(), or held at gain when
+ *  step is 0. Ramps are short, they are left to plain C */
+static void _hdcd_float_run(float *x, const int32_t *s, int count, int extend, int pe_level, int gain, int step)
+{
+    int i;
+    for (i = 0; i < count; i++)
+        x[i * 2] = _hdcd_float_base(x[i * 2], s[i * 2], extend, pe_level) * HDCD_FLOAT_GAIN(gain + (i + 1) * step);
+}
+
+/** _hdcd_float_run() at a steady level of count frames of interlaced
+ *  stereo in one pass, k0 and k1 from HDCD_FLOAT_GAIN(). Without peak
+ *  extend it is one multiply a sample, and s isn't read at all */
+static void _hdcd_float_hold_stereo(float *x, const int32_t *s, int count, int extend0, int extend1, int pe_level, float k0, float k1)
+{
+    int i = 0, c;
+
+#if defined(__AVX2__)
+    const __m256 half = _mm256_setr_ps(k0 * 0.5f, k1 * 0.5f, k0 * 0.5f, k1 * 0.5f,
+                                       k0 * 0.5f, k1 * 0.5f, k0 * 0.5f, k1 * 0.5f);
+    const __m256 one = _mm256_setr_ps(k0 * HDCD_FLOAT_LSB32, k1 * HDCD_FLOAT_LSB32, k0 * HDCD_FLOAT_LSB32, k1 * HDCD_FLOAT_LSB32,
+                                      k0 * HDCD_FLOAT_LSB32, k1 * HDCD_FLOAT_LSB32, k0 * HDCD_FLOAT_LSB32, k1 * HDCD_FLOAT_LSB32);
+    const __m256i level = _mm256_set1_epi32(pe_level);
+    const __m256i max = _mm256_set1_epi32(pe_max_asample);
+    const __m256i lanes = _mm256_setr_epi32(-!!extend0, -!!extend1, -!!extend0, -!!extend1,
+                                            -!!extend0, -!!extend1, -!!extend0, -!!extend1);
+    for (; i + 4 <= count; i += 4) {
+        __m256 r = _mm256_mul_ps(_mm256_loadu_ps(x + i * 2), half);
+        if (extend0 || extend1) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(s + i * 2));
+            __m256i a = _mm256_sub_epi32(_mm256_abs_epi32(v), level);
+            __m256i pe = _mm256_and_si256(_mm256_cmpgt_epi32(a, _mm256_set1_epi32(-1)), lanes);
+            if (!_mm256_testz_si256(pe, pe))
+                r = _mm256_blendv_ps(r, _mm256_mul_ps(_mm256_cvtepi32_ps(_hdcd_peaktab_x8(v, a, max, pe)), one),
+                    _mm256_castsi256_ps(pe));
+        }
+        _mm256_storeu_ps(x + i * 2, r);
+    }
+#elif defined(__SSE2__)
+    const __m128 half = _mm_setr_ps(k0 * 0.5f, k1 * 0.5f, k0 * 0.5f, k1 * 0.5f);
+    const __m128i level = _mm_set1_epi32(pe_level);
+    const int lanes = (extend0 ? 5 : 0) | (extend1 ? 10 : 0);
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_ps(x + i * 2, _mm_mul_ps(_mm_loadu_ps(x + i * 2), half));
+        if (lanes) {
+            /* the few that need the table are done one by one */
+            __m128i v = _mm_loadu_si128((const __m128i*)(s + i * 2));
+            __m128i sign = _mm_srai_epi32(v, 31);
+            __m128i a = _mm_sub_epi32(_mm_sub_epi32(_mm_xor_si128(v, sign), sign), level);
+            int pe = ~_mm_movemask_ps(_mm_castsi128_ps(a)) & lanes;
+            for (c = 0; pe && c < 4; c++)
+                if (pe & (1 << c))
+                    x[i * 2 + c] = _hdcd_float_base(0, s[i * 2 + c], 1, pe_level) * ((c & 1) ? k1 : k0);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        for (c = 0; c < 2; c++)
+            x[i * 2 + c] = _hdcd_float_base(x[i * 2 + c], s[i * 2 + c], c ? extend1 : extend0, pe_level) * (c ? k1 : k0);
+    }
+}
@@ -29,14 +29,39 @@
 #include <string.h>
 #include "hdcd_decode2.h"
 #include "hdcd_simple.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/** bit depths tried by hdcd_scan_depths() */
+#define HDCD_DEPTHS 3
+static const int hdcd_depth_bits[HDCD_DEPTHS] = { 16, 20, 24 };
+
+struct hdcd_lut_cache {
+    hdcd_luts luts;
+};
+
+/** used by hdcd_scan_depths(), allocated the first time */
+typedef struct {
+    hdcd_state_stereo state[HDCD_DEPTHS];
+    hdcd_detection_data detect[HDCD_DEPTHS];
+} hdcd_depths;
 
 struct hdcd_simple {
     hdcd_state_stereo state;
     hdcd_detection_data detect;
     hdcd_log logger;
+    hdcd_events events;
+    hdcd_luts *luts;            /**< belongs to the caller */
     int smode;
     int rate;
     int bits;
+
+    hdcd_depths *depths;        /**< NULL until hdcd_scan_depths() */
+
+    /* used by hdcd_process_float(), the samples as integers */
+    int *fbuf;
+    int fbuf_size;
 };
 
 /** set stereo processing mode, only used internally */
@@ -58,6 +83,7 @@ hdcd_simple *hdcd_new(void)
         memset(s, 0, sizeof(*s));
         _hdcd_log_init(&s->logger, NULL, NULL);
         _hdcd_log_disable(&s->logger);
+        _hdcd_events_init(&s->events);
         s->rate = 44100;
         s->bits = 16;
         hdcd_reset(s);
@@ -102,8 +128,13 @@ int hdcd_reset_ext(hdcd_simple *s, int rate, int bits)
     _hdcd_simple_reset_state(&s->state, s->rate, s->bits);
     _hdcd_detect_reset(&s->detect);
     _hdcd_attach_logger(&s->state, &s->logger);
+    _hdcd_attach_events(&s->state, &s->events);
+    _hdcd_attach_luts(&s->state, s->luts);
     hdcd_analyze_mode(s, 0);
     hdcd_smode(s, 1);
+    /* made again, at the new rate, if they are used */
+    free(s->depths);
+    s->depths = NULL;
     return 1;
 }
 
@@ -114,11 +145,29 @@ void hdcd_reset(hdcd_simple *s)
     hdcd_reset_ext(s, 0, 0);
 }
 
+/** every count the detection data comes from only goes up, and
+ *  sustain only starts with a valid packet and ends with an expiry,
+ *  so when this doesn't change, neither does the detection data */
+static int _hdcd_detect_tally(const hdcd_state_stereo *state)
+{
+    int i, t = 0;
+    for (i = 0; i < 2; i++) {
+        const hdcd_state *c = &state->channel[i];
+        t += c->code_counterA + c->code_counterA_almost
+            + c->code_counterB + c->code_counterB_checkfails
+            + c->code_counterC_unmatched + c->count_sustain_expired;
+    }
+    return t;
+}
+
 /** process signed 16-bit samples (stored in 32-bit), interlaced stereo */
 void hdcd_process(hdcd_simple *s, int *samples, int count)
 {
+    int tally;
     if (!s) return;
 
+    tally = _hdcd_detect_tally(&s->state);
+
     if (s->smode)
         /* process stereo channels together */
         _hdcd_process_stereo(&s->state, samples, count);
@@ -127,7 +176,50 @@ void hdcd_process(hdcd_simple *s, int *samples, int count)
         _hdcd_process(&s->state.channel[0], samples, count, 2);
         _hdcd_process(&s->state.channel[1], samples + 1, count, 2);
     }
-    _hdcd_detect_stereo(&s->state, &s->detect);
+    /* most blocks of most audio have no packets at all */
+    if (_hdcd_detect_tally(&s->state) != tally)
+        _hdcd_detect_stereo(&s->state, &s->detect);
+}
+
+int hdcd_process_float(hdcd_simple *s, float *samples, int count)
+{
+    int tally;
+    if (!s || !samples) return 0;
+    if (count <= 0) return 1;
+
+    if (count * 2 > s->fbuf_size) {
+        int *buf = realloc(s->fbuf, count * 2 * sizeof(int));
+        if (!buf) return 0;
+        s->fbuf = buf;
+        s->fbuf_size = count * 2;
+    }
+    /* the packets are in the integers, a float sample from 16-bit
+     * (or 24-bit) has all the bits */
+    _hdcd_float_in(samples, s->fbuf, count * 2, s->bits);
+
+    if (!s->smode || s->state.ana_mode) {
+        /* the analyze mode tone is made from the integer samples */
+        hdcd_process(s, s->fbuf, count);
+        _hdcd_float_out(s->fbuf, samples, count * 2);
+        return 1;
+    }
+
+    tally = _hdcd_detect_tally(&s->state);
+    _hdcd_process_stereo_float(&s->state, s->fbuf, samples, count);
+    if (_hdcd_detect_tally(&s->state) != tally)
+        _hdcd_detect_stereo(&s->state, &s->detect);
+    return 1;
+}
+
+/* scan without changing the samples, otherwise just like hdcd_process() */
+static void _hdcd_simple_scan(hdcd_state_stereo *state, int smode, const int *samples, int count)
+{
+    if (smode)
+        _hdcd_scan_stereo(state, samples, count);
+    else {
+        _hdcd_scan(&state->channel[0], samples, count, 2);
+        _hdcd_scan(&state->channel[1], samples + 1, count, 2);
+    }
 }
 
 /*hdcd_dv*/
@@ -135,13 +227,7 @@ int hdcd_scan(hdcd_simple *s, int *samples, int count, int ignore_state)
 {
     hdcd_state_stereo st;
     hdcd_detection_data d;
-    int buf_size = sizeof(int) * count * 2;
-    int *samp;
     if (!s) return 0;
-    /* The simplest way to do this is to copy everything and process.
-     * Perhaps later, a more efficient way can be implemented using
-     * calls to _hdcd_scan_stereo() until the first effectual packet
-     * is found */
     if (ignore_state) {
         _hdcd_simple_reset_state(&st, s->rate, s->bits);
         _hdcd_detect_reset(&d);
@@ -151,37 +237,848 @@ int hdcd_scan(hdcd_simple *s, int *samples, int count, int ignore_state)
     }
     if (d.hdcd_detected == HDCD_EFFECTUAL)
         return d.hdcd_detected; /* easy peasy */
-    samp = malloc(buf_size);
-    if (samp) {
-        memcpy(samp, samples, buf_size);
-        _hdcd_process_stereo(&st, samp, count);
-        _hdcd_detect_stereo(&st, &d);
-        free(samp);
-        return d.hdcd_detected;
-    } else return 0;
-
-    /* possible alternate method:
-    *samp = samples;
-    int c = count;
-    while (c) {
-        c -= _hdcd_scan_stereo(&st, samp_scan, c);
-        if (st.channel[0].count_peak_extend
-            || st.channel[1].count_peak_extend
-            || st.channel[0].max_gain
-            || st.channel[1].max_gain)
-            return HDCD_EFFECTUAL;
-    }
-    if (packets)
-        return HDCD_NO_EFFECT;
-    else
-        return HDCD_NONE;
-    */
+
+    /* The result can't be known before the end of the block:
+     * a code detect timer may still expire, and the timers are
+     * counted down per scan run, so stopping early or splitting
+     * the block could give a different answer than hdcd_process().
+     * The scan is cheap compared to processing, anyway. */
+    _hdcd_attach_logger(&st, NULL); /* not the messages a later hdcd_process() will log */
+    _hdcd_attach_events(&st, NULL);
+    _hdcd_simple_scan(&st, s->smode, samples, count);
+    _hdcd_detect_stereo(&st, &d);
+    return d.hdcd_detected;
+}
+
+/*hdcd_dv*/
+int hdcd_scan_process(hdcd_simple *s, const int *samples, int count)
+{
+    if (!s) return 0;
+    _hdcd_simple_scan(&s->state, s->smode, samples, count);
+    _hdcd_detect_stereo(&s->state, &s->detect);
+    return s->detect.hdcd_detected;
+}
+
+/** used by hdcd_scan_parallel() */
+#define HDCD_MAX_THREADS 64
+/** frames scanned before a chunk to find the scan state at its start */
+#define HDCD_CHUNK_OVERLAP 4096
+/** smaller chunks aren't worth a thread */
+#define HDCD_CHUNK_MIN 65536
+
+typedef struct {
+    hdcd_state_stereo state;    /**< scan-only copy */
+    const int *samples;         /**< the whole buffer */
+    int64_t base;               /**< position of the first frame in samples */
+    int start, end, overlap;    /**< in frames */
+    hdcd_state_stereo entry;    /**< the state at start */
+    hdcd_scan_record record;
+} hdcd_chunk;
+
+/** the part of the state that depends only on the samples scanned */
+static int _hdcd_chunk_same(const hdcd_state_stereo *a, const hdcd_state_stereo *b)
+{
+    int i;
+    for (i = 0; i < 2; i++) {
+        if (a->channel[i].window != b->channel[i].window
+            || a->channel[i].readahead != b->channel[i].readahead
+            || a->channel[i].arg != b->channel[i].arg)
+            return 0;
+    }
+    return 1;
+}
+
+static void _hdcd_chunk_take(hdcd_state_stereo *dst, const hdcd_state_stereo *src)
+{
+    int i;
+    for (i = 0; i < 2; i++) {
+        dst->channel[i].window = src->channel[i].window;
+        dst->channel[i].readahead = src->channel[i].readahead;
+        dst->channel[i].arg = src->channel[i].arg;
+    }
+}
+
+/** scan the overlap to get the state at the start of the chunk, then
+ *  record what is found in the chunk */
+static void _hdcd_chunk_scan(hdcd_chunk *c)
+{
+    hdcd_state_stereo *st = &c->state;
+    int i;
+
+    _hdcd_attach_logger(st, NULL);
+    _hdcd_attach_events(st, NULL);
+    for (i = 0; i < 2; i++) {
+        /* the timers would only split the scan into shorter runs */
+        st->channel[i].sustain = 0;
+        st->channel[i].position = c->base + c->start - c->overlap;
+    }
+    if (c->overlap)
+        _hdcd_scan_stereo(st, c->samples + (c->start - c->overlap) * 2, c->overlap);
+    memcpy(&c->entry, st, sizeof(hdcd_state_stereo));
+    st->channel[0].record = st->channel[1].record = &c->record;
+    _hdcd_scan_stereo(st, c->samples + c->start * 2, c->end - c->start);
+    st->channel[0].record = st->channel[1].record = NULL;
+}
+
+#ifdef HAVE_PTHREAD
+static void *_hdcd_chunk_thread(void *arg)
+{
+    _hdcd_chunk_scan(arg);
+    return NULL;
+}
+#endif
+
+/** scan each block with hdcd_scan_process() */
+static void _hdcd_scan_blocks(hdcd_simple *s, const int *samples, int count, int block)
+{
+    int i;
+    for (i = 0; i < count; i += block)
+        hdcd_scan_process(s, samples + i * 2, (count - i < block) ? count - i : block);
+}
+
+/** hdcd_scan_parallel(), and the timeline of the scan when tl isn't
+ *  NULL, which needs stereo mode. Room for the whole timeline is made
+ *  before the context is touched. If there is none, tl->error is set
+ *  and the context is left as it was. */
+static int _hdcd_scan_parallel_tl(hdcd_simple *s, const int *samples, int count, int block, int threads, hdcd_timeline *tl)
+{
+    hdcd_chunk *chunk;
+    hdcd_scan_record rec;
+    int n, i, k, error = 0;
+#ifdef HAVE_PTHREAD
+    pthread_t thread[HDCD_MAX_THREADS];
+    int started[HDCD_MAX_THREADS];
+#endif
+
+    if (!s || !samples || count <= 0) return 0;
+    if (block <= 0) block = count;
+    if (threads > HDCD_MAX_THREADS) threads = HDCD_MAX_THREADS;
+    n = count / HDCD_CHUNK_MIN;
+    if (n > threads) n = threads;
+    chunk = (n < 2 || !s->smode) ? NULL : malloc(n * sizeof(*chunk));
+    if (!chunk) {
+        if (tl)
+            tl->error = 1;
+        else
+            _hdcd_scan_blocks(s, samples, count, block);
+        return s->detect.hdcd_detected;
+    }
+    for (k = 0; k < n; k++) {
+        memcpy(&chunk[k].state, &s->state, sizeof(hdcd_state_stereo));
+        memset(&chunk[k].record, 0, sizeof(hdcd_scan_record));
+        chunk[k].samples = samples;
+        chunk[k].base = s->state.channel[0].position;
+        chunk[k].start = (int)((int64_t)count * k / n);
+        chunk[k].end = (int)((int64_t)count * (k + 1) / n);
+        /* the first starts from the real state */
+        chunk[k].overlap = (k) ? HDCD_CHUNK_OVERLAP : 0;
+    }
+
+#ifdef HAVE_PTHREAD
+    for (k = 1; k < n; k++)
+        started[k] = !pthread_create(&thread[k], NULL, _hdcd_chunk_thread, &chunk[k]);
+    _hdcd_chunk_scan(&chunk[0]);
+    for (k = 1; k < n; k++) {
+        if (started[k])
+            pthread_join(thread[k], NULL);
+        else
+            _hdcd_chunk_scan(&chunk[k]);
+    }
+#else
+    for (k = 0; k < n; k++)
+        _hdcd_chunk_scan(&chunk[k]);
+#endif
+
+    /* A chunk is only right if the overlap brought it to the state the
+     * chunk before it ended with. If not, scan it again from there. */
+    for (k = 1; k < n; k++) {
+        if (_hdcd_chunk_same(&chunk[k].entry, &chunk[k - 1].state))
+            continue;
+        _hdcd_scan_record_free(&chunk[k].record);
+        memcpy(&chunk[k].state, &chunk[k - 1].state, sizeof(hdcd_state_stereo));
+        chunk[k].overlap = 0;
+        _hdcd_chunk_scan(&chunk[k]);
+    }
+
+    /* join the records */
+    memset(&rec, 0, sizeof(rec));
+    for (k = 0; k < n; k++) {
+        error |= chunk[k].record.error;
+        rec.size += chunk[k].record.count;
+    }
+    if (!error && rec.size) {
+        rec.mark = malloc(rec.size * sizeof(hdcd_scan_mark));
+        if (!rec.mark) error = 1;
+    }
+    if (!error) {
+        for (k = 0; k < n; k++) {
+            if (chunk[k].record.count)
+                memcpy(rec.mark + rec.count, chunk[k].record.mark, chunk[k].record.count * sizeof(hdcd_scan_mark));
+            rec.count += chunk[k].record.count;
+        }
+    }
+
+    /* A run of the replay ends at the end of a block, at a packet, or
+     * where a timer expires, and a timer only expires once after each
+     * packet in its channel, or once at the start. Each block also adds
+     * the run after its last packet. */
+    if (!error && tl
+        && !_hdcd_timeline_reserve(tl, 2 * (((int64_t)count + block - 1) / block) + 2 * (int64_t)rec.count + 2))
+        error = 1;
+
+    if (error) {
+        if (tl)
+            tl->error = 1;
+        else
+            _hdcd_scan_blocks(s, samples, count, block);
+    } else {
+        /* replay it all in order as the same blocks would be scanned,
+         * so the timers, detection, log and events are all the same */
+        s->state.channel[0].record = &rec;
+        for (i = 0; i < count; i += block) {
+            _hdcd_scan_stereo_timeline(&s->state, NULL, (count - i < block) ? count - i : block, tl);
+            _hdcd_detect_stereo(&s->state, &s->detect);
+        }
+        s->state.channel[0].record = NULL;
+        _hdcd_chunk_take(&s->state, &chunk[n - 1].state);
+    }
+
+    _hdcd_scan_record_free(&rec);
+    for (k = 0; k < n; k++)
+        _hdcd_scan_record_free(&chunk[k].record);
+    free(chunk);
+    return s->detect.hdcd_detected;
+}
+
+/*hdcd_dv*/
+int hdcd_scan_parallel(hdcd_simple *s, const int *samples, int count, int block, int threads)
+{
+    return _hdcd_scan_parallel_tl(s, samples, count, block, threads, NULL);
+}
+
+/** a part of the buffer for hdcd_process_parallel() */
+typedef struct {
+    hdcd_state_stereo state;    /**< for the bit depth, without tables */
+    int *samples;               /**< the first frame of the part */
+    const hdcd_change *change;  /**< the run the part starts in */
+    int offset;                 /**< frames of that run before the part */
+    int count;                  /**< frames in the part */
+    int gain[2];                /**< running gain at the start */
+} hdcd_part;
+
+static void _hdcd_part_apply(hdcd_part *p)
+{
+    const hdcd_change *c = p->change;
+    int *samples = p->samples;
+    int count = p->count, offset = p->offset;
+
+    while (count > 0) {
+        hdcd_change r = *c++;
+        r.count -= offset;
+        offset = 0;
+        if (r.count > count) r.count = count;
+        _hdcd_apply_stereo(&p->state, samples, &r, 1, p->gain);
+        samples += r.count * 2;
+        count -= r.count;
+    }
+}
+
+#ifdef HAVE_PTHREAD
+static void *_hdcd_part_thread(void *arg)
+{
+    _hdcd_part_apply(arg);
+    return NULL;
+}
+#endif
+
+static void _hdcd_process_blocks(hdcd_simple *s, int *samples, int count, int block)
+{
+    int i;
+    for (i = 0; i < count; i += block)
+        hdcd_process(s, samples + i * 2, (count - i < block) ? count - i : block);
+}
+
+int hdcd_process_parallel(hdcd_simple *s, int *samples, int count, int block, int threads)
+{
+    hdcd_timeline tl;
+    hdcd_part *part;
+    const hdcd_change *c;
+    int gain[2];
+    int n, k, i, pos;
+#ifdef HAVE_PTHREAD
+    pthread_t thread[HDCD_MAX_THREADS];
+    int started[HDCD_MAX_THREADS];
+#endif
+
+    if (!s || !samples || count <= 0) return 0;
+    if (block <= 0) block = count;
+    if (threads > HDCD_MAX_THREADS) threads = HDCD_MAX_THREADS;
+    n = count / HDCD_CHUNK_MIN;
+    if (n > threads) n = threads;
+    /* the analyze mode tone is one sequence through the whole input */
+    if (n < 2 || !s->smode || s->state.ana_mode) {
+        _hdcd_process_blocks(s, samples, count, block);
+        return s->detect.hdcd_detected;
+    }
+
+    part = malloc(n * sizeof(*part));
+    if (!part) {
+        _hdcd_process_blocks(s, samples, count, block);
+        return s->detect.hdcd_detected;
+    }
+
+    /* the scan leaves the context as hdcd_process() on each block would,
+     * and the timeline tells the gain anywhere in the buffer */
+    gain[0] = s->state.channel[0].running_gain;
+    gain[1] = s->state.channel[1].running_gain;
+    memset(&tl, 0, sizeof(tl));
+    _hdcd_scan_parallel_tl(s, samples, count, block, threads, &tl);
+    if (tl.error) {
+        /* nothing was scanned, logged or sent as an event yet */
+        _hdcd_process_blocks(s, samples, count, block);
+        n = 0;
+    }
+
+    /* the run and gain where each part starts */
+    c = tl.change;
+    pos = 0;
+    for (k = 0; k < n; k++) {
+        int start = (int)((int64_t)count * k / n);
+        int end = (int)((int64_t)count * (k + 1) / n);
+        while (pos + c->count <= start) {
+            for (i = 0; i < 2; i++)
+                gain[i] = _hdcd_gain_run(c->count, gain[i], c->target_gain);
+            pos += c->count;
+            c++;
+        }
+        memcpy(&part[k].state, &s->state, sizeof(hdcd_state_stereo));
+        _hdcd_attach_luts(&part[k].state, NULL); /* not shared between threads */
+        part[k].samples = samples + start * 2;
+        part[k].change = c;
+        part[k].offset = start - pos;
+        part[k].count = end - start;
+        for (i = 0; i < 2; i++)
+            part[k].gain[i] = _hdcd_gain_run(part[k].offset, gain[i], c->target_gain);
+    }
+
+#ifdef HAVE_PTHREAD
+    for (k = 1; k < n; k++)
+        started[k] = !pthread_create(&thread[k], NULL, _hdcd_part_thread, &part[k]);
+    if (n) _hdcd_part_apply(&part[0]);
+    for (k = 1; k < n; k++) {
+        if (started[k])
+            pthread_join(thread[k], NULL);
+        else
+            _hdcd_part_apply(&part[k]);
+    }
+#else
+    for (k = 0; k < n; k++)
+        _hdcd_part_apply(&part[k]);
+#endif
+
+    _hdcd_timeline_free(&tl);
+    free(part);
+    return s->detect.hdcd_detected;
+}
+
+/** frames searched for a packet before the seek target, doubled until
+ *  one is found in each channel */
+#define HDCD_SEEK_STEP 4096
+/** events kept while searching, only the first packets are needed */
+#define HDCD_SEEK_EVENTS 64
+/** the code detect timers count down per call, so the window is scanned
+ *  again in blocks of a usual size, rather than all at once */
+#define HDCD_SEEK_BLOCK 2048
+
+int hdcd_seek(hdcd_simple *s, const int *samples, int count)
+{
+    hdcd_state_stereo st;
+    hdcd_events ev;
+    hdcd_event ring[HDCD_SEEK_EVENTS], e;
+    int control[2];
+    int found[2] = {0, 0};
+    int flags, i, n = 0, done = 0;
+    hdcd_ana_mode mode;
+
+    if (!s) return 0;
+
+    /* as hdcd_reset(), but keep the rate, bits, and analyze mode */
+    flags = s->state.channel[0].decoder_options;
+    mode = s->state.ana_mode;
+    _hdcd_simple_reset_state(&s->state, s->rate, s->bits);
+    s->state.channel[0].decoder_options = s->state.channel[1].decoder_options = flags;
+    _hdcd_set_analyze_mode(&s->state, mode);
+    _hdcd_detect_reset(&s->detect);
+    if (!samples || count <= 0) {
+        _hdcd_attach_logger(&s->state, &s->logger);
+        _hdcd_attach_events(&s->state, &s->events);
+        _hdcd_attach_luts(&s->state, s->luts);
+        return 0;
+    }
+
+    /* Look back from the target, a little further each time, until
+     * the first packet found in the window is known for each channel.
+     * In stereo, the gain follows the last target_gain both channels
+     * agreed on, so the first packets must agree too.
+     * Only the LSBs are scanned. */
+    while (n < count && !done) {
+        n = (n) ? n * 2 : HDCD_SEEK_STEP;
+        if (n > count) n = count;
+        _hdcd_simple_reset_state(&st, s->rate, s->bits);
+        _hdcd_events_init(&ev);
+        ev.ring = ring;
+        ev.size = HDCD_SEEK_EVENTS;
+        _hdcd_attach_events(&st, &ev);
+        _hdcd_simple_scan(&st, s->smode, samples + (count - n) * 2, n);
+        found[0] = found[1] = 0;
+        while (_hdcd_events_read(&ev, &e, 1)) {
+            if (e.type != HDCD_EVENT_PACKET || found[e.channel]) continue;
+            control[e.channel] = e.control;
+            found[e.channel] = 1;
+        }
+        done = found[0] && found[1]
+            && (!s->smode || (control[0] & 15) == (control[1] & 15));
+    }
+
+    /* Take the audio before those packets to have been at the same
+     * gain, then scan the window again to the target. The last packet
+     * in each channel sets control and the timer, and running_gain
+     * follows any change in between. */
+    if (found[0] && found[1]) {
+        for (i = 0; i < 2; i++) {
+            s->state.channel[i].control = control[i];
+            if (done || !s->smode)
+                s->state.channel[i].running_gain = (control[i] & 15) << 7;
+        }
+        for (i = count - n; i < count; i += HDCD_SEEK_BLOCK) {
+            int len = (count - i < HDCD_SEEK_BLOCK) ? count - i : HDCD_SEEK_BLOCK;
+            _hdcd_simple_scan(&s->state, s->smode, samples + i * 2, len);
+            _hdcd_detect_stereo(&s->state, &s->detect);
+        }
+        /* decoding continues from the target */
+        for (i = 0; i < 2; i++) {
+            s->state.channel[i].position = 0;
+            s->state.channel[i].sample_count = 0;
+        }
+    }
+    _hdcd_attach_logger(&s->state, &s->logger);
+    _hdcd_attach_events(&s->state, &s->events);
+    _hdcd_attach_luts(&s->state, s->luts);
+    return found[0] && found[1];
+}
+
+/** the bit depth that looks most like HDCD, or 0. When the packets are
+ *  also in a higher bit, as when the low bits copy the high bits, the
+ *  deepest is the one with the real LSB. */
+static int _hdcd_simple_best_depth(hdcd_simple *s)
+{
+    const hdcd_detection_data *d;
+    int i, best = -1;
+    if (!s->depths) return 0;
+    d = s->depths->detect;
+    for (i = 0; i < HDCD_DEPTHS; i++) {
+        if (d[i].hdcd_detected == HDCD_NONE)
+            continue;
+        if (best < 0
+            || d[i].hdcd_detected > d[best].hdcd_detected
+            || (d[i].hdcd_detected == d[best].hdcd_detected
+                && d[i].total_packets >= d[best].total_packets) )
+            best = i;
+    }
+    return (best < 0) ? 0 : hdcd_depth_bits[best];
+}
+
+int hdcd_scan_depths(hdcd_simple *s, const int *samples, int count)
+{
+    hdcd_depths *d;
+    int i;
+    if (!s) return 0;
+    if (!s->depths) {
+        d = malloc(sizeof(*d));
+        if (!d) return 0;
+        for (i = 0; i < HDCD_DEPTHS; i++) {
+            _hdcd_simple_reset_state(&d->state[i], s->rate, hdcd_depth_bits[i]);
+            d->state[i].channel[0].lsb_shift =
+                d->state[i].channel[1].lsb_shift = 24 - hdcd_depth_bits[i];
+            _hdcd_detect_reset(&d->detect[i]);
+        }
+        s->depths = d;
+    }
+    d = s->depths;
+    /* the block is scanned once for each depth while it is still
+     * in the cache, each a different bit of the same samples */
+    for (i = 0; i < HDCD_DEPTHS; i++) {
+        _hdcd_simple_scan(&d->state[i], s->smode, samples, count);
+        _hdcd_detect_stereo(&d->state[i], &d->detect[i]);
+    }
+    return _hdcd_simple_best_depth(s);
+}
+
+int hdcd_detect_depth(hdcd_simple *s)
+{
+    if (!s) return 0;
+    return _hdcd_simple_best_depth(s);
+}
+
+int hdcd_select_depth(hdcd_simple *s, int bits)
+{
+    hdcd_ana_mode mode;
+    int flags, i;
+    if (!s || !s->depths) return 0;
+    if (!bits) bits = _hdcd_simple_best_depth(s);
+    for (i = 0; i < HDCD_DEPTHS; i++) {
+        if (hdcd_depth_bits[i] != bits) continue;
+        /* keep the analyze mode and flags, as hdcd_seek() does */
+        flags = s->state.channel[0].decoder_options;
+        mode = s->state.ana_mode;
+        s->bits = bits;
+        memcpy(&s->state, &s->depths->state[i], sizeof(hdcd_state_stereo));
+        memcpy(&s->detect, &s->depths->detect[i], sizeof(hdcd_detection_data));
+        s->state.channel[0].decoder_options = s->state.channel[1].decoder_options = flags;
+        _hdcd_set_analyze_mode(&s->state, mode);
+        /* samples given to hdcd_process() have the LSB in bit 0 */
+        s->state.channel[0].lsb_shift = s->state.channel[1].lsb_shift = 0;
+        _hdcd_attach_logger(&s->state, &s->logger);
+        _hdcd_attach_events(&s->state, &s->events);
+        _hdcd_attach_luts(&s->state, s->luts);
+        return 1;
+    }
+    return 0;
+}
+
+/** state snapshot format, see hdcd_state_save() */
+#define HDCD_SNAPSHOT_MAGIC 0x48444344 /* "HDCD" */
+#define HDCD_SNAPSHOT_VERSION 2
+
+/** a snapshot being written or read, little-endian. Nothing is
+ *  written when p is NULL, only counted. */
+typedef struct {
+    uint8_t *p;
+    const uint8_t *in;
+    int n, size;
+} hdcd_snapshot;
+
+static void _hdcd_put(hdcd_snapshot *b, uint64_t v, int bytes)
+{
+    int i;
+    if (b->p && b->n + bytes <= b->size)
+        for (i = 0; i < bytes; i++)
+            b->p[b->n + i] = (uint8_t)(v >> (i * 8));
+    b->n += bytes;
+}
+
+/** 4-byte values are signed */
+static int64_t _hdcd_get(hdcd_snapshot *b, int bytes)
+{
+    uint64_t v = 0;
+    int i;
+    if (b->n + bytes <= b->size)
+        for (i = 0; i < bytes; i++)
+            v |= (uint64_t)b->in[b->n + i] << (i * 8);
+    b->n += bytes;
+    if (bytes == 4) return (int32_t)(uint32_t)v;
+    return (int64_t)v;
+}
+
+/** FNV-1a of the bytes of a snapshot before the sum itself */
+static uint32_t _hdcd_snapshot_sum(const uint8_t *p, int n)
+{
+    uint32_t h = 2166136261U;
+    int i;
+    for (i = 0; i < n; i++)
+        h = (h ^ p[i]) * 16777619U;
+    return h;
+}
+
+/* the same list of fields, to write or read */
+#define HDCD_SNAPSHOT_CHANNEL(X, c) \
+    X(c.decoder_options, 4) X(c.window, 8) X(c.readahead, 1) \
+    X(c.arg, 1) X(c.control, 1) X(c.sustain, 4) X(c.sustain_reset, 4) \
+    X(c.running_gain, 4) X(c.cdt_period, 4) \
+    X(c.code_counterA, 4) X(c.code_counterA_almost, 4) \
+    X(c.code_counterB, 4) X(c.code_counterB_checkfails, 4) \
+    X(c.code_counterC, 4) X(c.code_counterC_unmatched, 4) \
+    X(c.count_peak_extend, 4) X(c.count_transient_filter, 4) \
+    X(c.gain_counts[0], 4) X(c.gain_counts[1], 4) X(c.gain_counts[2], 4) \
+    X(c.gain_counts[3], 4) X(c.gain_counts[4], 4) X(c.gain_counts[5], 4) \
+    X(c.gain_counts[6], 4) X(c.gain_counts[7], 4) X(c.gain_counts[8], 4) \
+    X(c.gain_counts[9], 4) X(c.gain_counts[10], 4) X(c.gain_counts[11], 4) \
+    X(c.gain_counts[12], 4) X(c.gain_counts[13], 4) X(c.gain_counts[14], 4) \
+    X(c.gain_counts[15], 4) X(c.max_gain, 4) X(c.count_sustain_expired, 4) \
+    X(c.sample_count, 4) X(c.position, 8) X(c.ana_mode, 4) X(c._ana_snb, 4)
+
+#define HDCD_SNAPSHOT_STEREO(X, s) \
+    X(s.ana_mode, 4) X(s.val_target_gain, 4) X(s.count_tg_mismatch, 4) X(s.tgm_event, 4)
+
+#define HDCD_SNAPSHOT_DETECT(X, d) \
+    X(d.hdcd_detected, 4) X(d.packet_type, 4) X(d.total_packets, 4) \
+    X(d.errors, 4) X(d.peak_extend, 4) X(d.uses_transient_filter, 4) \
+    X(d.cdt_expirations, 4) X(d._active_count, 4)
+
+/** the fields of a snapshot, all but the sum at the end */
+static void _hdcd_snapshot_write(hdcd_simple *s, hdcd_snapshot *b, int total)
+{
+    uint32_t mga;
+#define PUT(f, bytes) _hdcd_put(b, (uint64_t)(s->f), bytes);
+    _hdcd_put(b, HDCD_SNAPSHOT_MAGIC, 4);
+    _hdcd_put(b, HDCD_SNAPSHOT_VERSION, 4);
+    _hdcd_put(b, total, 4);
+    PUT(rate, 4) PUT(bits, 4) PUT(smode, 4)
+    HDCD_SNAPSHOT_CHANNEL(PUT, state.channel[0])
+    HDCD_SNAPSHOT_CHANNEL(PUT, state.channel[1])
+    HDCD_SNAPSHOT_STEREO(PUT, state)
+    HDCD_SNAPSHOT_DETECT(PUT, detect)
+#undef PUT
+    memcpy(&mga, &s->detect.max_gain_adjustment, 4);
+    _hdcd_put(b, mga, 4);
+}
+
+int hdcd_state_save(hdcd_simple *s, void *buf, int size)
+{
+    hdcd_snapshot b = { NULL, NULL, 0, 0 };
+    int total;
+    if (!s) return 0;
+
+    /* the size is in the header, so count it first */
+    _hdcd_snapshot_write(s, &b, 0);
+    total = b.n + 4;
+    if (!buf) return total;
+    if (size < total) return 0;
+
+    b.p = buf;
+    b.n = 0;
+    b.size = size;
+    _hdcd_snapshot_write(s, &b, total);
+    _hdcd_put(&b, _hdcd_snapshot_sum(b.p, b.n), 4);
+    return total;
+}
+
+/** a snapshot read into t can't index past a table or pick a mode
+ *  that doesn't exist. sustain_reset and cdt_period are compared with
+ *  those of a fresh reset at the same rate, in fresh */
+static int _hdcd_snapshot_check(const hdcd_simple *t, const hdcd_state *fresh)
+{
+    const hdcd_state_stereo *st = &t->state;
+    const hdcd_detection_data *d = &t->detect;
+    int i;
+
+    if (t->smode != 0 && t->smode != 1) return 0;
+    if ((int)st->ana_mode < HDCD_ANA_OFF || (int)st->ana_mode > HDCD_ANA_TGM) return 0;
+    if (st->val_target_gain < 0 || st->val_target_gain > (0xf << 7)
+        || (st->val_target_gain & 0x7f)) return 0;
+    for (i = 0; i < 2; i++) {
+        const hdcd_state *c = &st->channel[i];
+        if (c->decoder_options & ~(HDCD_FLAG_FORCE_PE | HDCD_FLAG_TGM_LOG_OFF)) return 0;
+        if (c->running_gain < 0 || c->running_gain > (0xf << 7)) return 0;
+        if (c->max_gain < 0 || c->max_gain > 15) return 0;
+        if (c->control & 0xc0) return 0;
+        if (c->ana_mode != st->ana_mode) return 0;
+        if (c->readahead < 1 || c->readahead > 32) return 0;
+        if (c->sustain_reset != fresh->sustain_reset || c->cdt_period != fresh->cdt_period
+            || c->sustain > c->sustain_reset) return 0;
+    }
+    if ((int)d->hdcd_detected < HDCD_NONE || (int)d->hdcd_detected > HDCD_EFFECTUAL) return 0;
+    if ((int)d->packet_type < HDCD_PVER_NONE || (int)d->packet_type > HDCD_PVER_MIX) return 0;
+    if ((int)d->peak_extend < HDCD_PE_NEVER || (int)d->peak_extend > HDCD_PE_PERMANENT) return 0;
+    return 1;
+}
+
+int hdcd_state_restore(hdcd_simple *s, const void *buf, int size)
+{
+    hdcd_snapshot b = { NULL, buf, 0, size }, sum;
+    hdcd_simple t;
+    hdcd_state fresh;
+    int total, rate, bits;
+    uint32_t mga;
+    if (!s || !buf) return 0;
+    total = hdcd_state_save(s, NULL, 0);
+    if (size < total) return 0;
+    if ((uint32_t)_hdcd_get(&b, 4) != HDCD_SNAPSHOT_MAGIC) return 0;
+    if (_hdcd_get(&b, 4) != HDCD_SNAPSHOT_VERSION) return 0;
+    if (_hdcd_get(&b, 4) != total) return 0;
+    /* a truncated or damaged snapshot stops here */
+    sum = b;
+    sum.n = total - 4;
+    if ((uint32_t)_hdcd_get(&sum, 4) != _hdcd_snapshot_sum(buf, total - 4)) return 0;
+    rate = (int)_hdcd_get(&b, 4);
+    bits = (int)_hdcd_get(&b, 4);
+
+    /* read into t, and only change s when all of it is good */
+    memset(&t, 0, sizeof(t));
+    if (!hdcd_reset_ext(&t, rate, bits)) return 0;
+    t.smode = (int)_hdcd_get(&b, 4);
+#define GET(f, bytes) t.f = _hdcd_get(&b, bytes);
+    HDCD_SNAPSHOT_CHANNEL(GET, state.channel[0])
+    HDCD_SNAPSHOT_CHANNEL(GET, state.channel[1])
+    HDCD_SNAPSHOT_STEREO(GET, state)
+    HDCD_SNAPSHOT_DETECT(GET, detect)
+#undef GET
+    mga = (uint32_t)_hdcd_get(&b, 4);
+    memcpy(&t.detect.max_gain_adjustment, &mga, 4);
+    _hdcd_reset(&fresh, rate, bits, 0, 0);
+    if (!_hdcd_snapshot_check(&t, &fresh)) return 0;
+
+    hdcd_reset_ext(s, rate, bits);
+    hdcd_smode(s, t.smode);
+    memcpy(&s->state, &t.state, sizeof(hdcd_state_stereo));
+    memcpy(&s->detect, &t.detect, sizeof(hdcd_detection_data));
+    _hdcd_attach_logger(&s->state, &s->logger);
+    _hdcd_attach_events(&s->state, &s->events);
+    _hdcd_attach_luts(&s->state, s->luts);
+    /* the kernel for the analyze mode just read */
+    _hdcd_set_analyze_mode(&s->state, s->state.ana_mode);
+    return 1;
+}
+
+hdcd_simple *hdcd_clone(hdcd_simple *s)
+{
+    hdcd_simple *c;
+    if (!s) return NULL;
+    c = malloc(sizeof(*c));
+    if (!c) return NULL;
+    memcpy(c, s, sizeof(*c));
+    /* the ring belongs to the caller of the original */
+    c->events.ring = NULL;
+    c->events.size = c->events.head = c->events.count = c->events.lost = 0;
+    c->fbuf = NULL;
+    c->fbuf_size = 0;
+    /* a clone may run on another thread, the cache can't follow */
+    c->luts = NULL;
+    if (s->depths) {
+        c->depths = malloc(sizeof(hdcd_depths));
+        if (!c->depths) {
+            free(c);
+            return NULL;
+        }
+        memcpy(c->depths, s->depths, sizeof(hdcd_depths));
+    }
+    _hdcd_attach_logger(&c->state, &c->logger);
+    _hdcd_attach_events(&c->state, &c->events);
+    _hdcd_attach_luts(&c->state, NULL);
+    return c;
+}
+
+/** seek index format, see hdcd_index_add(). A header of magic, version,
+ *  entry size, and count, then the entries in order of position, each
+ *  the position and a snapshot. All the same size, to binary search. */
+#define HDCD_INDEX_MAGIC 0x48444358 /* "HDCX" */
+#define HDCD_INDEX_VERSION 1
+#define HDCD_INDEX_HEADER 16
+
+/** the number of entries, or -1 if it isn't an index made
+ *  with entries of this size */
+static int _hdcd_index_count(const void *index, int size, int entry)
+{
+    hdcd_snapshot b = { NULL, index, 0, size };
+    int count;
+    if (size < HDCD_INDEX_HEADER) return -1;
+    if ((uint32_t)_hdcd_get(&b, 4) != HDCD_INDEX_MAGIC) return -1;
+    if (_hdcd_get(&b, 4) != HDCD_INDEX_VERSION) return -1;
+    if (_hdcd_get(&b, 4) != entry) return -1;
+    count = (int)_hdcd_get(&b, 4);
+    if (count < 0 || count > (size - HDCD_INDEX_HEADER) / entry) return -1;
+    return count;
+}
+
+static int64_t _hdcd_index_position(const void *index, int entry, int i)
+{
+    hdcd_snapshot b = { NULL, index, HDCD_INDEX_HEADER + i * entry, HDCD_INDEX_HEADER + (i + 1) * entry };
+    return _hdcd_get(&b, 8);
+}
+
+int hdcd_index_size(hdcd_simple *s, int count)
+{
+    if (!s || count < 0) return 0;
+    return HDCD_INDEX_HEADER + count * (8 + hdcd_state_save(s, NULL, 0));
+}
+
+int hdcd_index_add(hdcd_simple *s, void *index, int size)
+{
+    hdcd_snapshot b = { index, index, 0, size };
+    int entry, count, at;
+    int64_t position;
+    if (!s || !index) return 0;
+    entry = 8 + hdcd_state_save(s, NULL, 0);
+    position = s->state.channel[0].position;
+
+    if (size >= 4 && !_hdcd_get(&b, 4))
+        count = 0; /* new */
+    else if ((count = _hdcd_index_count(index, size, entry)) < 0)
+        return 0;
+    if (count && _hdcd_index_position(index, entry, count - 1) >= position)
+        return 0;
+    at = HDCD_INDEX_HEADER + count * entry;
+    if (size < at + entry) return 0;
+
+    b.n = 0;
+    _hdcd_put(&b, HDCD_INDEX_MAGIC, 4);
+    _hdcd_put(&b, HDCD_INDEX_VERSION, 4);
+    _hdcd_put(&b, entry, 4);
+    _hdcd_put(&b, count + 1, 4);
+    b.n = at;
+    _hdcd_put(&b, position, 8);
+    hdcd_state_save(s, b.p + b.n, entry - 8);
+    return at + entry;
+}
+
+int64_t hdcd_seek_with_index(hdcd_simple *s, const void *index, int size, int64_t position)
+{
+    int entry, lo, hi;
+    if (!s || !index) return -1;
+    entry = 8 + hdcd_state_save(s, NULL, 0);
+    hi = _hdcd_index_count(index, size, entry);
+    if (hi < 1 || _hdcd_index_position(index, entry, 0) > position)
+        return -1;
+
+    /* the last entry at or before position */
+    lo = 0;
+    while (hi - lo > 1) {
+        int mid = lo + (hi - lo) / 2;
+        if (_hdcd_index_position(index, entry, mid) <= position)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (!hdcd_state_restore(s, (const uint8_t*)index + HDCD_INDEX_HEADER + lo * entry + 8, entry - 8))
+        return -1;
+    return _hdcd_index_position(index, entry, lo);
+}
+
+hdcd_lut_cache *hdcd_lut_new(size_t max_bytes)
+{
+    hdcd_lut_cache *c = malloc(sizeof(*c));
+    if (c) _hdcd_luts_init(&c->luts, max_bytes);
+    return c;
+}
+
+void hdcd_lut_free(hdcd_lut_cache *c)
+{
+    if (!c) return;
+    _hdcd_luts_free(&c->luts);
+    free(c);
+}
+
+int hdcd_lut_attach(hdcd_simple *s, hdcd_lut_cache *c)
+{
+    if (!s) return 0;
+    s->luts = (c) ? &c->luts : NULL;
+    _hdcd_attach_luts(&s->state, s->luts);
+    return 1;
+}
+
+void hdcd_lut_stats(const hdcd_lut_cache *c, int *hits, int *misses)
+{
+    if (hits) *hits = (c) ? c->luts.hits : 0;
+    if (misses) *misses = (c) ? c->luts.misses : 0;
 }
 
 /** free the context when finished */
 void hdcd_free(hdcd_simple *s)
 {
-    if(s) free(s);
+    if (!s) return;
+    free(s->fbuf);
+    free(s->depths);
+    free(s);
 }
 
 /** Is HDCD encoding detected? */
@@ -251,6 +1148,39 @@ void hdcd_logger_detach(hdcd_simple *s)
     _hdcd_log_disable(&s->logger);
 }
 
+int hdcd_events_callback(hdcd_simple *s, hdcd_event_callback func, void *priv)
+{
+    if (!s) return 0;
+    s->events.func = func;
+    s->events.priv = priv;
+    return 1;
+}
+
+int hdcd_events_buffer(hdcd_simple *s, hdcd_event *ring, int size)
+{
+    if (!s) return 0;
+    if (ring && size < 1) return 0;
+    s->events.ring = ring;
+    s->events.size = (ring) ? size : 0;
+    s->events.head = s->events.count = s->events.lost = 0;
+    return 1;
+}
+
+int hdcd_events_read(hdcd_simple *s, hdcd_event *events, int max)
+{
+    if (!s || !events) return 0;
+    return _hdcd_events_read(&s->events, events, max);
+}
+
+int hdcd_events_lost(hdcd_simple *ctx)
+{ if (ctx) return ctx->events.lost; else return 0; }
+
+void hdcd_events_detach(hdcd_simple *s)
+{
+    if (!s) return;
+    _hdcd_events_init(&s->events);
+}
+
 int hdcd_analyze_mode(hdcd_simple *s, int mode)
 {
     if (!s) return 0;
@@ -291,3 +1221,190 @@ void hdcd_logger_dump_state(hdcd_simple *s)
     for(i = 0; i < 2; i++)
         _hdcd_dump_state_to_log(&s->state.channel[i], i);
 }
+
+/** hdcd_detector.flags */
+#define HDCD_DF_A       1   /**< A packets */
+#define HDCD_DF_B       2   /**< B packets */
+#define HDCD_DF_TF      4   /**< a packet with the transient filter */
+#define HDCD_DF_PE      8   /**< a packet with peak extend */
+#define HDCD_DF_NO_PE  16   /**< a packet without peak extend */
+
+/** detection data as _hdcd_detect_stereo() would find it, from counters
+ *  that give the same results as the full ones */
+static void _hdcd_detector_data(const hdcd_detector *d, hdcd_state_stereo *st, hdcd_detection_data *detect)
+{
+    int i;
+    _hdcd_reset_stereo(st, d->rate, 16, 0, HDCD_FLAG_TGM_LOG_OFF);
+    for (i = 0; i < 2; i++) {
+        hdcd_state *c = &st->channel[i];
+        int a = (d->flags[i] & HDCD_DF_A) ? 1 : 0;
+        c->code_counterA = (d->flags[i] & HDCD_DF_B) ? a : (int)d->packets[i];
+        c->code_counterB = (int)d->packets[i] - c->code_counterA;
+        c->count_peak_extend = (d->flags[i] & HDCD_DF_PE) ? (int)d->packets[i] - !!(d->flags[i] & HDCD_DF_NO_PE) : 0;
+        c->count_transient_filter = !!(d->flags[i] & HDCD_DF_TF);
+        c->code_counterA_almost = (int)d->errors[i];
+        c->max_gain = d->max_gain[i];
+        c->sustain = d->sustain[i];
+        c->count_sustain_expired = d->cdt_expired[i];
+    }
+    _hdcd_detect_reset(detect);
+    _hdcd_detect_stereo(st, detect);
+    if (detect->hdcd_detected < d->detected)
+        detect->hdcd_detected = d->detected;
+}
+
+/* the detector is meant to fit in a cache line */
+typedef char _hdcd_detector_size_check[(sizeof(hdcd_detector) <= 64) ? 1 : -1];
+
+int hdcd_detector_reset(hdcd_detector *d, int rate)
+{
+    if (!d) return 0;
+    switch(rate) {
+        case 0:
+            rate = 44100;
+        case 44100:
+        case 88200:
+        case 176400:
+        case 48000:
+        case 96000:
+        case 192000:
+            break;
+        default:
+            return 0;
+    }
+    memset(d, 0, sizeof(*d));
+    d->rate = rate;
+    d->readahead[0] = d->readahead[1] = 32;
+    d->cdt_expired[0] = d->cdt_expired[1] = -1;
+    d->detected = HDCD_NONE;
+    return 1;
+}
+
+/** hdcd_detector_scan(), with the LSBs from map when it isn't NULL */
+static int _hdcd_detector_scan_map(hdcd_detector *d, const int *samples, int count, const hdcd_lsb_map *map)
+{
+    hdcd_state_stereo st;
+    hdcd_detection_data detect;
+    int i;
+    if (!d || !samples) return 0;
+
+    /* the same scan as a full context, from a copy that starts with
+     * the scanner state and fresh counters */
+    _hdcd_reset_stereo(&st, d->rate, 16, 0, HDCD_FLAG_TGM_LOG_OFF);
+    for (i = 0; i < 2; i++) {
+        hdcd_state *c = &st.channel[i];
+        c->window = d->window[i];
+        c->readahead = d->readahead[i];
+        c->arg = d->arg[i];
+        c->control = d->control[i];
+        c->sustain = d->sustain[i];
+        c->count_sustain_expired = (d->cdt_expired[i] < 0) ? -1 : 0;
+    }
+    st.channel[0].map = map;
+    _hdcd_scan_stereo(&st, samples, count);
+
+    for (i = 0; i < 2; i++) {
+        hdcd_state *c = &st.channel[i];
+        int packets = c->code_counterA + c->code_counterB;
+        d->window[i] = c->window;
+        d->readahead[i] = c->readahead;
+        d->arg[i] = c->arg;
+        d->control[i] = c->control;
+        d->sustain[i] = c->sustain;
+        d->packets[i] += packets;
+        d->errors[i] += c->code_counterA_almost + c->code_counterB_checkfails + c->code_counterC_unmatched;
+        if (c->count_sustain_expired >= 0)
+            d->cdt_expired[i] = ((d->cdt_expired[i] < 0) ? 0 : d->cdt_expired[i]) + c->count_sustain_expired;
+        if (c->max_gain > d->max_gain[i]) d->max_gain[i] = c->max_gain;
+        if (c->code_counterA) d->flags[i] |= HDCD_DF_A;
+        if (c->code_counterB) d->flags[i] |= HDCD_DF_B;
+        if (c->count_transient_filter) d->flags[i] |= HDCD_DF_TF;
+        if (c->count_peak_extend) d->flags[i] |= HDCD_DF_PE;
+        if (c->count_peak_extend < packets) d->flags[i] |= HDCD_DF_NO_PE;
+    }
+
+    _hdcd_detector_data(d, &st, &detect);
+    d->detected = detect.hdcd_detected;
+    return d->detected;
+}
+
+/*hdcd_dv*/
+int hdcd_detector_scan(hdcd_detector *d, const int *samples, int count)
+{
+    return _hdcd_detector_scan_map(d, samples, count, NULL);
+}
+
+int hdcd_detector_scan_batch(hdcd_detector *d, const int *const *samples, const int *count, int n)
+{
+    hdcd_lsb_map *map;
+    uint64_t *window, *words = NULL;
+    int i, found = 0;
+    if (!d || !samples || !count || n <= 0) return 0;
+
+    map = malloc(n * sizeof(*map));
+    window = malloc(2 * n * sizeof(*window));
+    if (map && window) {
+        for (i = 0; i < n; i++) {
+            window[2 * i] = d[i].window[0];
+            window[2 * i + 1] = d[i].window[1];
+        }
+        /* a detector always scans bit 0 */
+        words = _hdcd_lsb_map_streams(map, samples, count, window, n, 0);
+    }
+    /* without the memory, each is scanned on its own, the same way */
+    for (i = 0; i < n; i++)
+        if (_hdcd_detector_scan_map(&d[i], samples[i], count[i], (words) ? &map[i] : NULL) != HDCD_NONE)
+            found++;
+    free(words);
+    free(window);
+    free(map);
+    return found;
+}
+
+/*hdcd_dv*/
+int hdcd_detector_detected(const hdcd_detector *d)
+{
+    if (!d) return 0;
+    return d->detected;
+}
+
+/*hdcd_pf*/
+int hdcd_detector_packet_type(const hdcd_detector *d)
+{
+    hdcd_state_stereo st;
+    hdcd_detection_data detect;
+    if (!d) return 0;
+    _hdcd_detector_data(d, &st, &detect);
+    return detect.packet_type;
+}
+
+int hdcd_detector_total_packets(const hdcd_detector *d)
+{
+    if (!d) return 0;
+    return (int)(d->packets[0] + d->packets[1]);
+}
+
+int hdcd_detector_errors(const hdcd_detector *d)
+{
+    if (!d) return 0;
+    return (int)(d->errors[0] + d->errors[1]);
+}
+
+/*hdcd_pe*/
+int hdcd_detector_peak_extend(const hdcd_detector *d)
+{
+    hdcd_state_stereo st;
+    hdcd_detection_data detect;
+    if (!d) return 0;
+    _hdcd_detector_data(d, &st, &detect);
+    return detect.peak_extend;
+}
+
+void hdcd_detector_str(const hdcd_detector *d, char *str, int maxlen)
+{
+    hdcd_state_stereo st;
+    hdcd_detection_data detect;
+    if (!d || !str) return;
+    _hdcd_detector_data(d, &st, &detect);
+    _hdcd_detect_str(&detect, str, maxlen);
+}
@@ -29,9 +29,11 @@
 #define _HDCD_SIMPLE_H_
 
 #include <stdarg.h>
+#include <stddef.h>
 #include "hdcd_libversion.h"
 #include "hdcd_detect.h"         /* enums for various detection values */
 #include "hdcd_analyze.h"        /* enums and definitions for analyze modes */
+#include "hdcd_events.h"         /* event types */
 
 #ifdef __cplusplus
 extern "C" {
@@ -44,17 +46,99 @@ hdcd_simple *hdcd_new(void);
 /** process 16-bit samples (stored in 32-bit), interlaced stereo.
  *  the samples will be converted in place to 32-bit samples. */
 void hdcd_process(hdcd_simple *ctx, int *samples, int count);
+/** as hdcd_process(), but for float samples, interlaced stereo, in
+ *  place. Input is 1.0 full scale, and must have the bits of the depth
+ *  set by hdcd_reset_ext() to find the packets, a float sample from
+ *  16-bit or 24-bit PCM does. Output is as hdcd_process() would give,
+ *  1.0 for a 32-bit full scale, so a decoded sample can reach 1.0 only
+ *  with peak extend. The gain and peak extend are done in float.
+ *  returns 0 if it couldn't allocate, and samples are unchanged */
+int hdcd_process_float(hdcd_simple *ctx, float *samples, int count);
 /** on a song change or something, reset the decoding state */
 void hdcd_reset(hdcd_simple *ctx);
 /** version of hdcd_reset when not 44100Hz or 16-bit */
 int hdcd_reset_ext(hdcd_simple *ctx, int rate, int bits);
 /** free the context when finished */
 void hdcd_free(hdcd_simple *ctx);
+/** reset for a seek, then rebuild the decoding state from the most
+ *  recent packets before the target. samples are the count frames just
+ *  before the target (two seconds is plenty), they are only scanned.
+ *  Processing continues with the samples at the target.
+ *  returns 1 if a packet was found in each channel */
+int hdcd_seek(hdcd_simple *ctx, const int *samples, int count);
+
+/** write a snapshot of the decoding state and detection data to buf,
+ *  to continue later with hdcd_state_restore(), maybe in another
+ *  process. The format is versioned and the same on every platform.
+ *  The logger, events, and hdcd_scan_depths() results are not saved.
+ *  returns the bytes written, 0 if size is too small, or with
+ *  buf = NULL, the size needed */
+int hdcd_state_save(hdcd_simple *ctx, void *buf, int size);
+/** returns 1 on success, 0 if the snapshot is not usable: too short,
+ *  damaged, or with a value out of range. Then ctx is unchanged */
+int hdcd_state_restore(hdcd_simple *ctx, const void *buf, int size);
+/** a new context with the same state, to try something and keep the
+ *  original. The logger and event callback are shared, but not the
+ *  event ring or the lookup table cache, which can be attached again
+ *  with hdcd_lut_attach() if both stay on one thread. Free it with
+ *  hdcd_free() */
+hdcd_simple *hdcd_clone(hdcd_simple *ctx);
+
+/** A seek index holds snapshots made every so often while decoding, to
+ *  seek later without looking back. It is one flat buffer that can be
+ *  saved as a file and mapped back into memory as it is.
+ *  the bytes needed for count entries */
+int hdcd_index_size(hdcd_simple *ctx, int count);
+/** add a snapshot of the current state, at the current position (frames
+ *  processed since the last reset) to the index, which must start as
+ *  zeros. Add them between calls to hdcd_process(), at increasing
+ *  positions. returns the bytes of the index used, 0 if it is full */
+int hdcd_index_add(hdcd_simple *ctx, void *index, int size);
+/** restore the last entry at or before position. Processing continues
+ *  with the samples at the returned position. The result is exact
+ *  when the samples are given to hdcd_process() in the same blocks
+ *  as when the index was made. returns -1 if there is no such entry */
+int64_t hdcd_seek_with_index(hdcd_simple *ctx, const void *index, int size, int64_t position);
 
 /** as hdcd_process(), but only scan. samples remain unprocessed.
  *  return expected value of hdcd_detected() after processing */
 /*hdcd_dv*/
 int hdcd_scan(hdcd_simple *ctx, int *samples, int count, int ignore_state);
+/** as hdcd_process(), but only scan. samples remain unprocessed,
+ *  but the context is updated as if they were processed, so it can
+ *  be used to quickly look for HDCD, and continue with hdcd_process().
+ *  (not in an analyze mode, the tone will be out of phase)
+ *  returns hdcd_detected() */
+/*hdcd_dv*/
+int hdcd_scan_process(hdcd_simple *ctx, const int *samples, int count);
+/** as hdcd_scan_process() for each block of count frames, one block
+ *  after another, but the buffer is split between threads.
+ *  The results are exactly the same. block = 0 for one block of count.
+ *  returns hdcd_detected() */
+/*hdcd_dv*/
+int hdcd_scan_parallel(hdcd_simple *ctx, const int *samples, int count, int block, int threads);
+/** as hdcd_process() for each block of count frames, one block after
+ *  another, but decoded in two passes: a scan of the whole buffer that
+ *  lists where the control changes, as hdcd_scan_parallel(), then the
+ *  decoding, split between threads. The results are exactly the same.
+ *  Stereo mode only, in an analyze mode or with independent channels
+ *  it is hdcd_process() on each block. block = 0 for one block of count.
+ *  returns hdcd_detected() */
+/*hdcd_dv*/
+int hdcd_process_parallel(hdcd_simple *ctx, int *samples, int count, int block, int threads);
+
+/** look for HDCD at the 16, 20, and 24-bit LSB positions at once, in
+ *  24-bit samples (stored in 32-bit, LSB in bit 0), for 24-bit files
+ *  that may only hold 16 or 20-bit audio. samples remain unprocessed.
+ *  returns the bit depth where HDCD was found, or 0 */
+int hdcd_scan_depths(hdcd_simple *ctx, const int *samples, int count);
+/** the bit depth found by hdcd_scan_depths(), or 0 */
+int hdcd_detect_depth(hdcd_simple *ctx);
+/** use the results of hdcd_scan_depths() for bits (0 for the one found)
+ *  as if hdcd_reset_ext(ctx, rate, bits) then hdcd_scan_process() was
+ *  used. Detection values and further processing are at that depth,
+ *  in the analyze mode already set. returns 1 on success */
+int hdcd_select_depth(hdcd_simple *ctx, int bits);
 
 /** is HDCD encoding detected? */
 /*hdcd_dv*/ int hdcd_detected(hdcd_simple *ctx);                  /**< see hdcd_dv in hdcd_detect.h */
@@ -80,10 +164,77 @@ void hdcd_logger_detach(hdcd_simple *ctx);
 void hdcd_logger_dump_state(hdcd_simple *s);
 
 
+/** get packets, errors, and control changes as events, see hdcd_events.h.
+ *  events are found during hdcd_process() or hdcd_scan_process().
+ *  Use a callback, a ring buffer, or both. */
+int hdcd_events_callback(hdcd_simple *ctx, hdcd_event_callback func, void *priv); /* func = NULL to remove */
+/** size is the number of events the ring can hold. Events that
+ *  don't fit are dropped and counted by hdcd_events_lost() */
+int hdcd_events_buffer(hdcd_simple *ctx, hdcd_event *ring, int size);    /* ring = NULL to remove */
+/** take up to max events from the ring, returns the number taken */
+int hdcd_events_read(hdcd_simple *ctx, hdcd_event *events, int max);
+int hdcd_events_lost(hdcd_simple *ctx);
+void hdcd_events_detach(hdcd_simple *ctx);
+
+
 /** set the analyze mode */
 int hdcd_analyze_mode(hdcd_simple *ctx, int mode);
 
 
+/** Lookup tables for decoding 16-bit samples. While the gain holds
+ *  steady, each sample is one load from a table made for that gain and
+ *  peak extend setting. The output is the same as without. Tables are
+ *  256 KiB each and built when first needed. When max_bytes is full,
+ *  the least recently used is replaced. There are at most 32 different
+ *  tables, 8 MiB, and most material needs only a few. One cache can be
+ *  used by many contexts, but only from one thread at a time. */
+typedef struct hdcd_lut_cache hdcd_lut_cache;
+
+hdcd_lut_cache *hdcd_lut_new(size_t max_bytes);
+void hdcd_lut_free(hdcd_lut_cache *cache);
+/** use the cache for ctx, until it is attached to another, or NULL to
+ *  stop using one. It stays attached after hdcd_reset(). */
+int hdcd_lut_attach(hdcd_simple *ctx, hdcd_lut_cache *cache);
+/** runs that found their table, and runs that didn't */
+void hdcd_lut_stats(const hdcd_lut_cache *cache, int *hits, int *misses);
+
+
+/** A detect-only context, one cache line, to watch many streams at
+ *  once. It keeps only the scanner state and what detection needs.
+ *  The fields are private, they are here so an array of them can be
+ *  allocated or declared. Results are those hdcd_scan_process() would
+ *  give for the same blocks of interlaced stereo samples. */
+typedef struct {
+    uint64_t window[2];
+    uint32_t sustain[2];
+    uint32_t packets[2];
+    uint32_t errors[2];
+    int32_t cdt_expired[2];
+    uint32_t rate;
+    uint8_t readahead[2], arg[2], control[2], max_gain[2], flags[2];
+    uint8_t detected;
+} hdcd_detector;
+
+/** returns 0 for an unusable sample rate */
+int hdcd_detector_reset(hdcd_detector *d, int rate);
+/** returns hdcd_detected() */
+/*hdcd_dv*/
+int hdcd_detector_scan(hdcd_detector *d, const int *samples, int count);
+/** hdcd_detector_scan() on n detectors, d[i] with count[i] frames of
+ *  samples[i]. The LSBs of all the streams are packed and searched for
+ *  packet prefixes together, with as many streams side by side as the
+ *  vectors hold: four with AVX2. The results are exactly those of
+ *  hdcd_detector_scan() on each. returns the number where HDCD packets
+ *  have been detected */
+int hdcd_detector_scan_batch(hdcd_detector *d, const int *const *samples, const int *count, int n);
+/*hdcd_dv*/ int hdcd_detector_detected(const hdcd_detector *d);
+/*hdcd_pf*/ int hdcd_detector_packet_type(const hdcd_detector *d);
+            int hdcd_detector_total_packets(const hdcd_detector *d);
+            int hdcd_detector_errors(const hdcd_detector *d);
+/*hdcd_pe*/ int hdcd_detector_peak_extend(const hdcd_detector *d);
+void hdcd_detector_str(const hdcd_detector *d, char *str, int maxlen);
+
+
 #ifdef __cplusplus
 }
 #endif
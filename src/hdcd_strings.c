@@ -27,6 +27,7 @@
 
 #include "hdcd_analyze.h"
 #include "hdcd_detect.h"
+#include "hdcd_events.h"
 
 const char* hdcd_str_analyze_mode_desc(hdcd_ana_mode mode)
 {
@@ -70,3 +71,15 @@ const char* hdcd_str_pformat(hdcd_pf v) {
     if (v < 0 || v > 3) return "";
     return pf_str[v];
 }
+
+const char* hdcd_str_event(hdcd_event_type v) {
+    static const char * const ev_str[] = {
+        "packet",
+        "almost A",
+        "B check failed",
+        "code detect timer expired",
+        "target gain mismatch"
+    };
+    if (v < 0 || v > 4) return "";
+    return ev_str[v];
+}
@@ -30,6 +30,13 @@
  */
 
 #include <stdlib.h>
+#ifdef HDCD_CHECK_PEAKTAB
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#endif
 
 /* #included in hdcd_decode2.c */
 
@@ -654,27 +661,89 @@ static const uint32_t peaktab[0x2680] = {
 };
 static const int pe_max_asample = sizeof(peaktab) / sizeof(peaktab[0]) - 1;
 
-static const uint8_t readaheadtab[] = {
-    0x03, 0x02, 0x01, 0x01, 0x1f, 0x1e, 0x1f, 0x11, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f,
-    0x10, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1c, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e,
-    0x1f, 0x0f, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1c, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f,
-    0x1e, 0x1f, 0x1b, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1c, 0x1f, 0x1e, 0x1f, 0x1d,
-    0x1f, 0x1e, 0x0e, 0x19, 0x07, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1c, 0x1f, 0x1e, 0x1f,
-    0x1d, 0x1f, 0x1e, 0x1f, 0x1b, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1c, 0x1f, 0x1e,
-    0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1a, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1c, 0x1f,
-    0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1b, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1c,
-    0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x0d, 0x18, 0x20, 0x06, 0x1e, 0x1f, 0x12, 0x1f, 0x1e, 0x1f,
-    0x1c, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1b, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e,
-    0x1f, 0x1c, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1a, 0x08, 0x1e, 0x1f, 0x1d, 0x1f,
-    0x1e, 0x1f, 0x1c, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1b, 0x1f, 0x1e, 0x1f, 0x1d,
-    0x1f, 0x1e, 0x1f, 0x1c, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x19, 0x1f, 0x13, 0x1f,
-    0x1d, 0x1f, 0x1e, 0x1f, 0x1c, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1b, 0x09, 0x1e,
-    0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1c, 0x1f, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1a, 0x14,
-    0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1c, 0x0a, 0x1e, 0x1f, 0x1d, 0x1f, 0x1e, 0x1f, 0x1b,
-    0x15, 0x1e, 0x1f, 0x1d, 0x0b, 0x1e, 0x1f, 0x1c, 0x16, 0x1e, 0x0c, 0x1d, 0x17, 0x1e, 0x1f,
-    0x20
+/** with HDCD_COMPACT_PEAKTAB set, peak extend uses pe_block[] in place
+ *  of peaktab[] */
+#ifndef HDCD_COMPACT_PEAKTAB
+#define HDCD_COMPACT_PEAKTAB 0
+#endif
+
+/* peaktab[] is straight lines that bend only at the start of a
+ * 64-entry block, and every entry is a multiple of 0x100. In eight
+ * blocks a step is rounded the other way once, so the entries after
+ * knee are adj off the line. The whole table is exactly
+ *
+ *   peaktab[i] = (base + k * step + (k > knee ? adj : 0)) << 8
+ *
+ * with pe_block[i >> 6] and k = i & 63. 1232 bytes instead of 39424.
+ *
+ * To check it against peaktab[] entry by entry, and time both:
+ * gcc -O2 -o pe_check -DHDCD_CHECK_PEAKTAB hdcd_tables.c -lm
+ * ./pe_check
+ * "./pe_check -c" only checks, tests.sh runs it that way.
+ */
+typedef struct {
+    uint32_t base;
+    uint16_t step;
+    uint8_t knee;
+    int8_t adj;
+} hdcd_pe_block;
+
+static const hdcd_pe_block pe_block[0x2680 / 64] = {
+    { 0x2cc083,  131, 63,  0 }, { 0x2ce143,  131, 63,  0 }, { 0x2d0203,  131, 63,  0 }, { 0x2d22c3,  131, 63,  0 },
+    { 0x2d4383,  131, 63,  0 }, { 0x2d6443,  131, 63,  0 }, { 0x2d8503,  131, 63,  0 }, { 0x2da5c3,  131, 63,  0 },
+    { 0x2dc687,  135, 63,  0 }, { 0x2de847,  135, 63,  0 }, { 0x2e0a07,  135, 63,  0 }, { 0x2e2bc7,  135, 63,  0 },
+    { 0x2e4d87,  135, 63,  0 }, { 0x2e6f47,  135, 63,  0 }, { 0x2e9107,  135, 63,  0 }, { 0x2eb2c7,  135, 63,  0 },
+    { 0x2ed487,  135, 63,  0 }, { 0x2ef647,  135, 63,  0 }, { 0x2f1807,  135, 63,  0 }, { 0x2f39c7,  135, 63,  0 },
+    { 0x2f5b87,  135, 63,  0 }, { 0x2f7d47,  135, 63,  0 }, { 0x2f9f07,  135, 63,  0 }, { 0x2fc0c7,  135, 63,  0 },
+    { 0x2fe296,  150, 63,  0 }, { 0x300816,  150, 63,  0 }, { 0x302d96,  150, 63,  0 }, { 0x305316,  150, 63,  0 },
+    { 0x307896,  150, 63,  0 }, { 0x309e16,  150, 63,  0 }, { 0x30c396,  150, 63,  0 }, { 0x30e916,  150, 63,  0 },
+    { 0x310e96,  150, 63,  0 }, { 0x313416,  150, 20, -1 }, { 0x315995,  150, 63,  0 }, { 0x317f15,  150, 63,  0 },
+    { 0x31a495,  150, 63,  0 }, { 0x31ca15,  150, 63,  0 }, { 0x31ef95,  150, 63,  0 }, { 0x321515,  150, 63,  0 },
+    { 0x323aa4,  165, 63,  0 }, { 0x3263e4,  165, 63,  0 }, { 0x328d24,  165, 63,  0 }, { 0x32b664,  165, 63,  0 },
+    { 0x32dfa4,  165, 63,  0 }, { 0x3308e4,  165, 63,  0 }, { 0x333224,  165, 63,  0 }, { 0x335b64,  165, 63,  0 },
+    { 0x3384a7,  168, 63,  0 }, { 0x33aea7,  168, 62,  1 }, { 0x33d8a8,  168, 63,  0 }, { 0x3402a8,  168, 63,  0 },
+    { 0x342ca8,  168, 63,  0 }, { 0x3456a8,  168, 63,  0 }, { 0x3480a8,  168, 63,  0 }, { 0x34aaa8,  168, 63,  0 },
+    { 0x34d4bb,  187, 63,  0 }, { 0x35037b,  187, 63,  0 }, { 0x35323b,  187, 63,  0 }, { 0x3560fb,  187, 63,  0 },
+    { 0x358fbb,  187, 63,  0 }, { 0x35be7b,  187, 63,  0 }, { 0x35ed3b,  187, 63,  0 }, { 0x361bfb,  187, 63,  0 },
+    { 0x364ac0,  192, 63,  0 }, { 0x367ac0,  192, 63,  0 }, { 0x36aac0,  192, 63,  0 }, { 0x36dac0,  192, 63,  0 },
+    { 0x370ac0,  192, 63,  0 }, { 0x373ac0,  192, 63,  0 }, { 0x376ac0,  192, 63,  0 }, { 0x379ac0,  192, 63,  0 },
+    { 0x37cad8,  216, 63,  0 }, { 0x3800d8,  216, 63,  0 }, { 0x3836d8,  216, 63,  0 }, { 0x386cd7,  216, 63,  0 },
+    { 0x38a2d7,  216, 63,  0 }, { 0x38d8d7,  216, 63,  0 }, { 0x390ed7,  216, 63,  0 }, { 0x3944d7,  216, 63,  0 },
+    { 0x397ae9,  234, 63,  0 }, { 0x39b569,  234, 63,  0 }, { 0x39efe9,  234, 63,  0 }, { 0x3a2a69,  234, 63,  0 },
+    { 0x3a64e9,  234, 63,  0 }, { 0x3a9f69,  234, 63,  0 }, { 0x3ad9e9,  234, 41,  1 }, { 0x3b146a,  234, 63,  0 },
+    { 0x3b4f00,  256, 63,  0 }, { 0x3b8f00,  256, 63,  0 }, { 0x3bcf00,  256, 63,  0 }, { 0x3c0f00,  256, 63,  0 },
+    { 0x3c4f00,  256, 63,  0 }, { 0x3c8f00,  256, 63,  0 }, { 0x3ccf00,  256, 63,  0 }, { 0x3d0f00,  256, 63,  0 },
+    { 0x3d4f22,  290, 63,  0 }, { 0x3d97a2,  290, 63,  0 }, { 0x3de022,  290, 63,  0 }, { 0x3e28a2,  290, 63,  0 },
+    { 0x3e7121,  290, 63,  0 }, { 0x3eb9a1,  290, 63,  0 }, { 0x3f0221,  290, 63,  0 }, { 0x3f4aa1,  290, 63,  0 },
+    { 0x3f9353,  340, 63,  0 }, { 0x3fe853,  340, 63,  0 }, { 0x403d53,  340, 63,  0 }, { 0x409253,  340, 63,  0 },
+    { 0x40e753,  340, 63,  0 }, { 0x413c53,  340, 63,  0 }, { 0x419153,  340, 63,  0 }, { 0x41e653,  340, 63,  0 },
+    { 0x423b9d,  414, 63,  0 }, { 0x42a31d,  414, 63,  0 }, { 0x430a9d,  414, 63,  0 }, { 0x43721d,  414, 63,  0 },
+    { 0x43d99d,  414, 63,  0 }, { 0x44411d,  414, 63,  0 }, { 0x44a89d,  414, 63,  0 }, { 0x45101d,  414, 63,  0 },
+    { 0x4577e3,  484, 63,  0 }, { 0x45f0e3,  484, 63,  0 }, { 0x4669e3,  484, 63,  0 }, { 0x46e2e3,  484, 63,  0 },
+    { 0x475c3f,  576, 63,  0 }, { 0x47ec3f,  576, 63,  0 }, { 0x487c3f,  576, 63,  0 }, { 0x490c3f,  576, 63,  0 },
+    { 0x499cb3,  692, 57,  1 }, { 0x4a49b4,  692, 63,  0 }, { 0x4af6cc,  716, 63,  0 }, { 0x4ba9cc,  716,  4, -1 },
+    { 0x4c5d77,  888, 63,  0 }, { 0x4d3b77,  888, 63,  0 }, { 0x4e19ff, 1024, 63,  0 }, { 0x4f19ff, 1024, 63,  0 },
+    { 0x501a77, 1144, 20,  1 }, { 0x513968, 1384, 63,  0 }, { 0x5293c0, 1472,  7, -1 }, { 0x54055f, 1888, 63,  0 },
+    { 0x55de9f, 2208, 63,  0 }, { 0x58087f, 2688, 63,  0 }, { 0x5aaa07, 3080, 62,  1 }, { 0x5dac80, 3200, 63,  0 },
+    { 0x60cc80, 3200, 63,  0 }, { 0x63ec80, 3200, 63,  0 }, { 0x670c80, 3200, 63,  0 }, { 0x6a2c80, 3200, 63,  0 },
+    { 0x6d4c80, 3200, 63,  0 }, { 0x706c80, 3200, 63,  0 }, { 0x738c80, 3200, 63,  0 }, { 0x76ac80, 3200, 63,  0 },
+    { 0x79cc80, 3200, 63,  0 }, { 0x7cec80, 3200, 63,  0 }
 };
 
+/** the same as peaktab[i] */
+static inline uint32_t _hdcd_peaktab_compact(int i)
+{
+    const hdcd_pe_block *b = &pe_block[i >> 6];
+    int k = i & 63;
+    return (b->base + k * b->step + ((k > b->knee) ? b->adj : 0)) << 8;
+}
+
+#if HDCD_COMPACT_PEAKTAB
+#define PEAKTAB(i) _hdcd_peaktab_compact(i)
+#else
+#define PEAKTAB(i) peaktab[i]
+#endif
+
 // values between 0 and 1 multiplied by 2^23 to avoid floating point numbers.
 static const int32_t gaintab[] = {
     0x800000, 0x7ff144, 0x7fe28a, 0x7fd3d2, 0x7fc51b, 0x7fb666, 0x7fa7b3, 0x7f9901, 0x7f8a52, 0x7f7ba3, 0x7f6cf7, 0x7f5e4c, 0x7f4fa3, 0x7f40fc, 0x7f3256,
@@ -807,3 +876,91 @@ static const int32_t gaintab[] = {
     0x3657ae, 0x36516d, 0x364b2c, 0x3644ec, 0x363ead, 0x36386f, 0x363231, 0x362bf4, 0x3625b8, 0x361f7c, 0x361942, 0x361308, 0x360cce, 0x360695, 0x36005e,
     0x35fa26
 };
+
+#ifdef HDCD_CHECK_PEAKTAB
+
+/* amplitudes above the PE level, as an index into peaktab[] */
+static void pe_amplitudes(int *idx, int count, int dist)
+{
+    int n;
+    srand(1);
+    for (n = 0; n < count; n++) {
+        double r = (rand() + 1.0) / (RAND_MAX + 2.0);
+        switch (dist) {
+            case 0: /* anywhere, the worst case for the cache */
+                idx[n] = rand() % 0x2680;
+                break;
+            case 1: /* most peaks just over the level */
+                idx[n] = (int)(-log(r) * 600);
+                break;
+            default: /* loud, limited master, bunched near full scale */
+                idx[n] = 0x2680 - 1 - (int)(-log(r) * 300);
+                break;
+        }
+        if (idx[n] < 0) idx[n] = 0;
+        if (idx[n] > pe_max_asample) idx[n] = pe_max_asample;
+    }
+}
+
+/* ns per lookup, over rounds of a block of count amplitudes. With
+ * evict, something else runs over a 64 KiB working set between rounds */
+static double pe_time(const int *idx, int count, int rounds, int compact, int evict, uint32_t *sum)
+{
+    static volatile uint8_t other[1 << 16];
+    struct timespec t0, t1;
+    double ns = 0;
+    uint32_t s = 0;
+    int n, r, j;
+
+    for (r = 0; r < rounds; r++) {
+        if (evict)
+            for (j = 0; j < (int)sizeof(other); j += 64) other[j]++;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (compact)
+            for (n = 0; n < count; n++) s += _hdcd_peaktab_compact(idx[n]);
+        else
+            for (n = 0; n < count; n++) s += peaktab[idx[n]];
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ns += (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    }
+    *sum = s;
+    return ns / ((double)count * rounds);
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *dist_name[] = { "uniform", "near level", "near full" };
+    const int count = 2048, rounds = 4096;
+    int *idx = malloc(count * sizeof(int));
+    int i, d, e, bad = 0;
+
+    for (i = 0; i <= pe_max_asample; i++) {
+        if (_hdcd_peaktab_compact(i) != peaktab[i]) {
+            printf("peaktab[0x%04x] = 0x%08x, compact = 0x%08x\n",
+                i, peaktab[i], _hdcd_peaktab_compact(i) );
+            bad++;
+        }
+    }
+    printf("%d of %d entries differ\n", bad, pe_max_asample + 1);
+    if (bad || !idx) return 1;
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        free(idx);
+        return 0;
+    }
+
+    for (e = 0; e < 2; e++) {
+        for (d = 0; d < 3; d++) {
+            uint32_t s0, s1;
+            double t0, t1;
+            pe_amplitudes(idx, count, d);
+            t0 = pe_time(idx, count, rounds, 0, e, &s0);
+            t1 = pe_time(idx, count, rounds, 1, e, &s1);
+            printf("%-10s%s  peaktab: %6.2f ns  compact: %6.2f ns%s\n",
+                dist_name[d], (e) ? ", evicted" : "         ",
+                t0, t1, (s0 != s1) ? "  (sum differs)" : "");
+        }
+    }
+    free(idx);
+    return 0;
+}
+#endif
@@ -77,6 +77,26 @@ test_pipes() {
     rm -f "$TOUT.md5" "$TOUT.md5.k" "$TOUT.md5.target" "$TOUT.md5.k.target"
 }
 
+# the compact peaktab of src/hdcd_tables.c, every entry against peaktab[]
+test_peaktab() {
+    ((TESTS++))
+    TOUT="$TMP/hdcd_tests_pe_check_$$"
+    echo "-test-peaktab:"
+    if ! ${CC:-cc} -O2 -DHDCD_CHECK_PEAKTAB -o "$TOUT" src/hdcd_tables.c -lm; then
+        echo "-- FAILED [build]"
+        EXIT_CODE=1
+        die_on_fail
+    elif ! "$TOUT" -c; then
+        echo "-- FAILED [peaktab]"
+        EXIT_CODE=1
+        die_on_fail
+    else
+        echo "-- PASSED"
+        ((PASSED++))
+    fi
+    rm -f "$TOUT"
+}
+
 do_test() {
     TOPT="-j $1"
     TFILE="test/$2"
@@ -152,6 +172,7 @@ verify_files
 mkmix
 
 test_pipes
+test_peaktab
 
 # format:
 #   do_test <options> <test_file> <md5_result> <exit_code> [<test_title>]
@@ -225,6 +246,8 @@ do_test "-qx"             "hdcd24.wav"     "" 0 "hdcd-24bit"
 do_test "-qx"             "hdcd20in24.wav" "" 1 "hdcd-20bit-in24-no"
 # specifiy 20-bit, and HDCD is found
 do_test "-qx -e :20"      "hdcd20in24.wav" "" 0 "hdcd-20bit-in24-yes"
+# look at every bit depth, and HDCD is found
+do_test "-qxb"            "hdcd20in24.wav" "" 0 "hdcd-20bit-in24-depths"
 
 # multiple -x tests
 # has HDCD but all packets are NOP
@@ -232,6 +255,35 @@ do_test "-qxx"            "hdcd-err.wav"   "" 1 "hdcd-xx-fail"
 # has HDCD but only uses LLE
 do_test "-qxx"            "hdcd-tgm.wav"   "" 0 "hdcd-xx-pass"
 do_test "-qxxx"           "hdcd-tgm.wav"   "" 1 "hdcd-xxx-fail"
+# same, scanned with threads
+do_test "-qxx -t 4"       "hdcd-tgm.wav"   "" 0 "hdcd-xx-pass-threads"
+# only a few windows spread over the file
+do_test "-qx -w 4:1"      "hdcd.wav"       "" 0 "hdcd-sampled"
+do_test "-qx -w 4:1"      "ava16.wav"      "" 1 "ava16-sampled"
+# start 5s in, the same as the end of a full decode
+do_test "-qxp -g 5"       "hdcd.wav"       "00d85976d4b68316f08bc238866db383" 0 "hdcd-seek"
+# make a seek index while decoding, then start 5s in from it
+TINDEX="$TMP/hdcd_tests_index_$$"
+do_test "-qxp -M $TINDEX:1" "hdcd.wav"    "5db465a58d2fd0d06ca944b883b33476" 0 "hdcd-seek-index-make"
+do_test "-qxp -g 5 -G $TINDEX" "hdcd.wav" "00d85976d4b68316f08bc238866db383" 0 "hdcd-seek-index"
+# damage a byte in every entry, the index is refused
+TCOUNT=$(od -An -tu4 -j12 -N4 "$TINDEX")
+TENTRY=$(( ($(wc -c <"$TINDEX") - 16) / TCOUNT ))
+for ((i = 0; i < TCOUNT; i++)); do
+    printf '\x5a' | dd of="$TINDEX" bs=1 seek=$((16 + i * TENTRY + 60)) conv=notrunc 2>/dev/null
+done
+do_test "-q -g 5 -G $TINDEX" "hdcd.wav"  "" 1 "hdcd-seek-index-damaged"
+rm -f "$TINDEX"
+# lookup tables, with room for only a few of them
+do_test "-qxp -L 1"       "hdcd-ftm.wav"   "c8c094ad88f43cb9eda1fa2d9b121664" 0 "for-the-masses-lut"
+do_test "-qxp -L 1"       "hdcd-pfa.wav"   "760628f8e3c81e7f7f94fdf594decd61" 0 "pfa-special-mode-lut"
+# decoded with threads, after a scan of the whole input
+do_test "-qxp -t 4"       "hdcd-ftm.wav"   "c8c094ad88f43cb9eda1fa2d9b121664" 0 "for-the-masses-threads"
+do_test "-qxp -t 4"       "hdcd-err.wav"   "0f7c3581950e57564d72ad96200bb648" 0 "hdcd-err-threads"
+do_test "-qxp -g 5 -t 4"  "hdcd.wav"       "00d85976d4b68316f08bc238866db383" 0 "hdcd-seek-threads"
+# decoded in float, the same for every instruction set
+do_test "-qxpF"           "hdcd-ftm.wav"   "0fd7deab957e60c8807f64e65cbedd01" 0 "for-the-masses-float"
+do_test "-qxpF"           "hdcd24.wav"     "a57968ea2906622a5aa51ad39a5e6899" 0 "hdcd-24bit-float"
 # has HDCD and uses PE
 do_test "-qxxx"           "hdcd-all.wav"   "" 0 "hdcd-xxx-pass"
 
@@ -42,6 +42,148 @@ static const char* amode_name[] = {
   "off", "lle", "pe", "cdt", "tgm", "pel", "ltgm"
 };
 
+/* priv is NULL, or points to the frame the position is counted from */
+static void print_event(const void *priv, const hdcd_event *ev) {
+    long long offset = (priv) ? *(const long long*)priv : 0;
+    fprintf(stderr, "event: %lld ch%d 0x%02x %s\n",
+        (long long)ev->position + offset, ev->channel, ev->control, hdcd_str_event(ev->type) );
+}
+
+/* shift to put the LSB in bit 0 */
+static void shift_samples(int32_t *samples, int count, int bits_per_sample) {
+    int i;
+    for (i = 0; i < count; i++)
+        samples[i] >>= 32 - bits_per_sample;
+}
+
+typedef struct {
+    int windows, found; /* windows scanned, and where HDCD was detected */
+    long frames, total; /* frames scanned, of the total */
+} sparse_result;
+
+/* scan windows of window_frames spread evenly over a seekable input,
+ * each with a fresh context. returns the context of the window with
+ * the most certain result, or NULL if the input can't be sampled. */
+static hdcd_simple *sparse_scan(wavio *wav, int windows, long window_frames,
+    int sample_rate, int bits_per_sample, int quiet, int events, sparse_result *res) {
+    const int frame_length = 2048;
+    int32_t *buf;
+    hdcd_simple *best = NULL;
+    long long offset = 0; /* used with events */
+    long total = wav_frames(wav);
+    int w;
+
+    memset(res, 0, sizeof(*res));
+    res->total = total;
+    if (windows < 1 || total < (long)windows * window_frames)
+        return NULL;
+    buf = malloc(2 * frame_length * sizeof(int32_t));
+    if (!buf) return NULL;
+
+    for (w = 0; w < windows; w++) {
+        hdcd_simple *ctx;
+        long start = (windows > 1) ? (long)((double)(total - window_frames) * w / (windows - 1)) : 0;
+        long left = window_frames;
+
+        if (!wav_seek(wav, start)) break;
+        ctx = hdcd_new();
+        if (!ctx || !hdcd_reset_ext(ctx, sample_rate, bits_per_sample)) {
+            hdcd_free(ctx);
+            break;
+        }
+        if (!quiet) hdcd_logger_default(ctx);
+        offset = start;
+        if (events) hdcd_events_callback(ctx, print_event, &offset);
+        while (left > 0) {
+            int count = (left < frame_length) ? (int)left : frame_length;
+            int read = wav_read_samples(wav, buf, count * 2);
+            count = read / 2;
+            if (count <= 0) break;
+            shift_samples(buf, count * 2, bits_per_sample);
+            hdcd_scan_process(ctx, buf, count);
+            res->frames += count;
+            left -= count;
+        }
+        res->windows++;
+        if (hdcd_detected(ctx)) res->found++;
+        if (!best || hdcd_detected(ctx) > hdcd_detected(best)
+            || (hdcd_detected(ctx) == hdcd_detected(best)
+                && hdcd_detect_total_packets(ctx) > hdcd_detect_total_packets(best)) ) {
+            hdcd_free(best);
+            best = ctx;
+        } else
+            hdcd_free(ctx);
+        /* events of the best are done */
+        if (best) hdcd_events_detach(best);
+    }
+    free(buf);
+    return best;
+}
+
+/* seek to frame, or if the input can't seek, read up to it from
+ * the start. returns 0 if the input ends first */
+static int seek_frames(wavio *wav, long frame, int channels) {
+    int32_t buf[1024];
+    int read;
+    if (wav_seek(wav, frame)) return 1;
+    while (frame > 0) {
+        long want = (frame * channels < 1024) ? frame * channels : 1024 / channels * channels;
+        read = wav_read_samples(wav, buf, (int)want);
+        if (read <= 0) return 0;
+        frame -= read / channels;
+    }
+    return 1;
+}
+
+/* -j testing: scan three streams made from the block with
+ * hdcd_detector_scan_batch(), and each with hdcd_detector_scan(), and
+ * compare the detectors. They are the block, the block from its second
+ * frame, and its first half, so the lanes differ in content and length.
+ * returns 0 if they don't match. */
+static int test_batch(hdcd_detector *batch, hdcd_detector *single, const int *samples, int count) {
+    const int *b[3];
+    int n[3], i, found, ret = 1;
+
+    b[0] = samples;     n[0] = count;
+    b[1] = samples + 2; n[1] = count - 1;
+    b[2] = samples;     n[2] = count / 2;
+    found = hdcd_detector_scan_batch(batch, b, n, 3);
+    for (i = 0; i < 3; i++) {
+        if (hdcd_detector_scan(&single[i], b[i], n[i]) != HDCD_NONE)
+            found--;
+        if (memcmp(&batch[i], &single[i], sizeof(hdcd_detector)) != 0)
+            ret = 0;
+    }
+    return ret && !found;
+}
+
+/* -j testing: replace *ctx with a copy of itself, made with a
+ * snapshot and restore into a reset context on odd blocks, and
+ * hdcd_clone() on even blocks. returns 0 on failure. */
+static int test_copy_state(hdcd_simple **ctx, long block) {
+    hdcd_simple *c;
+    uint8_t *buf;
+    int size, ret = 0;
+
+    if (!(block & 1)) {
+        c = hdcd_clone(*ctx);
+        if (!c) return 0;
+        hdcd_free(*ctx);
+        *ctx = c;
+        return 1;
+    }
+
+    size = hdcd_state_save(*ctx, NULL, 0);
+    buf = malloc(size);
+    if (!buf) return 0;
+    if (hdcd_state_save(*ctx, buf, size) == size) {
+        hdcd_reset(*ctx);
+        ret = hdcd_state_restore(*ctx, buf, size);
+    }
+    free(buf);
+    return ret;
+}
+
 static void usage(const char* name, int kmode) {
     int i;
     if (kmode) {
@@ -83,6 +225,19 @@ static void usage(const char* name, int kmode) {
         "    -c\t\t output to stdout\n"
         "    -d\t\t dump full detection data instead of summary\n"
         "      \t\t   (-dd even more, -ddd more still)\n"
+        "    -l\t\t list packets and other events as they are found\n"
+        "    -b\t\t with 24-bit input, look for HDCD at 16, 20, and 24-bit\n"
+        "      \t\t at once, and report the bit depth where it was found\n"
+        "    -t <n>\t read the whole input and scan or decode it\n"
+        "      \t\t with n threads\n"
+        "    -g <sec>\t start at sec seconds into the input\n"
+        "    -G <file>\t with -g, start from the seek index in file\n"
+        "    -M <file>[:<sec>]\t write a seek index to file while decoding,\n"
+        "      \t\t an entry every sec seconds (default 10)\n"
+        "    -w <n>[:<sec>]\t only scan n windows of sec seconds (default 3)\n"
+        "      \t\t spread over the input, each on its own\n"
+        "    -L <MiB>\t decode 16-bit input with lookup tables, up to\n"
+        "      \t\t MiB of them (a table is 256 KiB)\n"
         "    -z <mode>\t analyze modes:\n");
     for(i = 0; i <= 6; i++)
         fprintf(stderr,
@@ -90,6 +245,7 @@ static void usage(const char* name, int kmode) {
     fprintf(stderr,
         "    -p\t\t output raw s24le PCM samples only without\n"
         "      \t\t any wav header\n"
+        "    -F\t\t output 32-bit float, decoded in float\n"
         "    -e <rate>[:<bps>[:<channels>]]\n"
         "      \t\t sample rate, bits per sample, channel count of raw input\n"
         "      \t\t     rates: 44100 (default), 88200, 176400, 48000, 96000, or 192000\n"
@@ -133,8 +289,28 @@ int main(int argc, char *argv[]) {
         opt_ka = 0, opt_ks = 0, opt_kr = 0, opt_ki = 0;
     int opt_help = 0, opt_dump = 0;
     int opt_raw_out = 0, opt_raw_in = 0, raw_rate = 44100, raw_bps = 16, raw_channels = 2, opt_e = 0;
-    int opt_nop = 0, opt_testing = 0;
-    int dv; /* used with opt_testing */
+    int opt_nop = 0, opt_testing = 0, opt_events = 0, opt_depths = 0, opt_threads = 0;
+    int32_t *scan_buf = NULL; /* used with opt_threads */
+    int opt_sparse = 0, sampled = 0;
+    double opt_sparse_len = 3.0;
+    double opt_start = 0; /* seconds */
+    char *index_in = NULL, *index_out = NULL; /* -G, -M */
+    double opt_index_every = 10.0;
+    uint8_t *index = NULL;
+    int index_size = 0, index_used = 0, index_count = 0;
+    long index_next = 0, skip = 0; /* in frames */
+    sparse_result sparse;
+    int scan_size = 0;
+    hdcd_event events[64]; /* used with opt_events */
+    int events_lost = 0; /* the count last reported */
+    int dv = 0; /* used with opt_testing */
+    hdcd_detector detector; /* used with opt_testing */
+    hdcd_detector batch[3], single[3]; /* used with opt_testing */
+    int test_failed = 0; /* used with opt_testing */
+    int opt_lut = 0;
+    int opt_float = 0;
+    float *float_buf = NULL; /* used with opt_float */
+    hdcd_lut_cache *lut = NULL; /* used with opt_lut */
 
     int exit_value = 0; /* depends on xmode */
 
@@ -142,7 +318,7 @@ int main(int argc, char *argv[]) {
     char dstr[256];
     char *delim = NULL;
 
-    while ((c = getopt(argc, argv, "acdDe:fhijkno:pqrsvxz:")) != -1) {
+    while ((c = getopt(argc, argv, "abcdDe:fFg:G:hijklL:M:no:pqrst:vw:xz:")) != -1) {
         switch (c) {
             case 'x':
                 xmode++;
@@ -180,6 +356,9 @@ int main(int argc, char *argv[]) {
             case 'f':
                 opt_force = 1;
                 break;
+            case 'F':
+                opt_float = 1;
+                break;
             case 'e':
                 opt_e = 1;
                 i = atoi(optarg);
@@ -208,6 +387,46 @@ int main(int argc, char *argv[]) {
             case 'd':
                 opt_dump++;
                 break;
+            case 'l':
+                opt_events = 1;
+                break;
+            case 'b':
+                opt_depths = 1;
+                break;
+            case 't':
+                opt_threads = atoi(optarg);
+                break;
+            case 'g':
+                opt_start = atof(optarg);
+                break;
+            case 'G':
+                index_in = optarg;
+                break;
+            case 'M':
+                index_out = optarg;
+                delim = strchr(optarg, ':');
+                if (delim) {
+                    *delim = 0;
+                    opt_index_every = atof(delim + 1);
+                }
+                if (opt_index_every <= 0) {
+                    usage(argv[0], kmode);
+                    return 1;
+                }
+                break;
+            case 'w':
+                opt_sparse = atoi(optarg);
+                delim = strchr(optarg, ':');
+                if (delim && atof(delim + 1) > 0)
+                    opt_sparse_len = atof(delim + 1);
+                if (opt_sparse < 1) {
+                    usage(argv[0], kmode);
+                    return 1;
+                }
+                break;
+            case 'L':
+                opt_lut = atoi(optarg);
+                break;
             case 'a':
                 opt_ka = 1;
                 break;
@@ -345,6 +564,37 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "%d-bit is not fully supported: may be scanned, but expansion is very experimental and possibly completely incorrect.\n", bits_per_sample);
     }
 
+    if (opt_depths) {
+        if (bits_per_sample == 16) {
+            if (!opt_quiet) fprintf(stderr, "Looking for other bit depths requires 24-bit input\n");
+            return 1;
+        }
+        if (outfile) {
+            if (!opt_quiet) fprintf(stderr, "Looking for other bit depths only scans, no output\n");
+            return 1;
+        }
+    }
+
+    if (opt_start > 0 && (opt_sparse || opt_depths)) {
+        if (!opt_quiet) fprintf(stderr, "Can't start at an offset when sampling or looking for bit depths\n");
+        return 1;
+    }
+
+    if (index_in && opt_start <= 0) {
+        if (!opt_quiet) fprintf(stderr, "A seek index is used with -g\n");
+        return 1;
+    }
+
+    if (index_out && (opt_start > 0 || opt_sparse || opt_depths || opt_nop)) {
+        if (!opt_quiet) fprintf(stderr, "A seek index is made while decoding from the start\n");
+        return 1;
+    }
+
+    if (opt_sparse && (outfile || opt_depths || opt_nop)) {
+        if (!opt_quiet) fprintf(stderr, "Sampling windows only scans, no output\n");
+        return 1;
+    }
+
     bits_per_sample_out = bits_per_sample;
     output_data_length = input_data_length;
 
@@ -364,12 +614,20 @@ int main(int argc, char *argv[]) {
                 break;
         }
 
+    if (outfile && opt_float) {
+        bits_per_sample_out = 32;
+        output_data_length = input_data_length / ((bits_per_sample + 7) / 8) * 4;
+    }
+
     if (outfile) {
         if( !opt_force && strcmp(outfile, "-") != 0 && access( outfile, F_OK ) != -1 ) {
             if (!opt_quiet) fprintf(stderr, "Output file exists, use -f to overwrite\n");
             return 1;
         } else {
-            wav_out = wav_write_open(outfile, channels, sample_rate, bits_per_sample_out, opt_raw_out, output_data_length);
+            if (opt_float)
+                wav_out = wav_write_open_float(outfile, channels, sample_rate, opt_raw_out, output_data_length);
+            else
+                wav_out = wav_write_open(outfile, channels, sample_rate, bits_per_sample_out, opt_raw_out, output_data_length);
             if (!wav_out) return 1;
         }
     }
@@ -385,6 +643,25 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     if (!opt_quiet) hdcd_logger_default(ctx);
+    hdcd_detector_reset(&detector, sample_rate);
+    for (i = 0; i < 3; i++) {
+        hdcd_detector_reset(&batch[i], sample_rate);
+        hdcd_detector_reset(&single[i], sample_rate);
+    }
+    if (opt_lut > 0) {
+        lut = hdcd_lut_new((size_t)opt_lut << 20);
+        hdcd_lut_attach(ctx, lut);
+    }
+    /* threads only help with the whole input at once */
+    if (opt_testing || opt_depths || opt_ki || opt_nop || opt_sparse || index_out || opt_float)
+        opt_threads = 0;
+    if (opt_events) {
+        /* with threads, the events are all found at the end */
+        if (opt_threads)
+            hdcd_events_callback(ctx, print_event, NULL);
+        else
+            hdcd_events_buffer(ctx, events, 64);
+    }
     if (amode) {
         if (!outfile) {
             if (!opt_quiet) fprintf(stderr, "Without an output file, analyze mode does nothing\n");
@@ -400,38 +677,158 @@ int main(int argc, char *argv[]) {
     if (!opt_quiet) {
         fprintf(stderr, "Input: s%dle @%dHz %dch %s ", bits_per_sample, sample_rate, channels, opt_raw_in ? "RAW" : "WAV" );
         if (outfile)
-            fprintf(stderr, "-> Output: s%dle @%dHz %dch %s\n", bits_per_sample_out, sample_rate, channels, opt_raw_out ? "RAW" : "WAV" );
+            fprintf(stderr, "-> Output: %c%dle @%dHz %dch %s\n", opt_float ? 'f' : 's', bits_per_sample_out, sample_rate, channels, opt_raw_out ? "RAW" : "WAV" );
         else
             fprintf(stderr, "-> [scan]\n");
     }
 
 
+    if (opt_sparse) {
+        hdcd_simple *best = sparse_scan(wav, opt_sparse, (long)(opt_sparse_len * sample_rate),
+            sample_rate, bits_per_sample, opt_quiet, opt_events, &sparse);
+        if (best) {
+            hdcd_free(ctx);
+            ctx = best;
+            full_count = sparse.frames;
+            sampled = 1;
+        } else {
+            if (!opt_quiet) fprintf(stderr, "Input is too short or can't seek, scanning all of it\n");
+            wav_seek(wav, 0);
+        }
+    }
+
+    if (opt_start > 0 && index_in) {
+        /* restore the last index entry before the start, and decode
+         * from there in the same blocks, but only write from the start */
+        long start = (long)(opt_start * sample_rate);
+        long long at = -1;
+        FILE *f = fopen(index_in, "rb");
+        if (f) {
+            fseek(f, 0, SEEK_END);
+            index_size = (int)ftell(f);
+            fseek(f, 0, SEEK_SET);
+            index = malloc(index_size);
+            if (index && fread(index, 1, index_size, f) == (size_t)index_size)
+                at = hdcd_seek_with_index(ctx, index, index_size, start);
+            fclose(f);
+        }
+        if (at < 0 || !seek_frames(wav, (long)at, channels)) {
+            if (!opt_quiet) fprintf(stderr, "Can't use seek index: %s\n", index_in);
+            return 1;
+        }
+        skip = start - (long)at;
+    } else if (opt_start > 0) {
+        /* the decoding state is rebuilt from the packets in the two
+         * seconds before the start, which are only scanned */
+        long start = (long)(opt_start * sample_rate);
+        long pre = (start < 2 * sample_rate) ? start : 2 * sample_rate;
+        int32_t *pre_buf = malloc(pre * channels * sizeof(int32_t));
+        if (!pre_buf) {
+            if (!opt_quiet) fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        seek_frames(wav, start - pre, channels);
+        read = wav_read_samples(wav, pre_buf, pre * channels);
+        if (read > 0 && !opt_nop) {
+            shift_samples(pre_buf, read, bits_per_sample);
+            hdcd_seek(ctx, pre_buf, read / channels);
+        }
+        free(pre_buf);
+    }
+
     process_buf = (int32_t*) malloc(channels * frame_length * sizeof(int32_t));
     nb_samples = channels * frame_length;
+    if (outfile && opt_float) {
+        float_buf = malloc(nb_samples * sizeof(float));
+        if (!float_buf) {
+            if (!opt_quiet) fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
 
-    while (1) {
+    while (!sampled) {
         read = wav_read_samples(wav, process_buf, nb_samples);
         count = read / channels;
         /* if there isn't a full set, then forget the last one */
         if (read % channels) count--;
         if (count < 0) count = 0;
 
-        if (!opt_nop) {
-            /* shift to put the LSB in bit 0 */
-            for (i = 0; i < read; i++) {
-                if (bits_per_sample == 16)
-                    process_buf[i] >>= 16;
-                if (bits_per_sample == 20)
-                    process_buf[i] >>= 12;
-                if (bits_per_sample == 24)
-                    process_buf[i] >>= 8;
+        if (!opt_nop && opt_depths) {
+            /* all depths are scanned in the 24-bit samples */
+            for (i = 0; i < read; i++)
+                process_buf[i] >>= 8;
+            hdcd_scan_depths(ctx, process_buf, count);
+        } else if (!opt_nop) {
+            shift_samples(process_buf, read, bits_per_sample);
+
+            if (index_out && full_count >= index_next) {
+                /* an entry at the start of a block, so decoding
+                 * from it will be in the same blocks */
+                if (hdcd_index_size(ctx, index_count + 1) > index_size) {
+                    int size = hdcd_index_size(ctx, index_count * 2 + 16);
+                    uint8_t *buf = realloc(index, size);
+                    if (!buf) {
+                        if (!opt_quiet) fprintf(stderr, "Out of memory\n");
+                        return 1;
+                    }
+                    memset(buf + index_size, 0, size - index_size);
+                    index = buf;
+                    index_size = size;
+                }
+                index_used = hdcd_index_add(ctx, index, index_size);
+                if (!index_used) {
+                    if (!opt_quiet) fprintf(stderr, "Failed to add a seek index entry\n");
+                    return 1;
+                }
+                index_count++;
+                index_next += (long)(opt_index_every * sample_rate);
+            }
+
+            if (opt_threads) {
+                /* keep it all for hdcd_scan_parallel() or
+                 * hdcd_process_parallel() */
+                if (full_count + count > scan_size) {
+                    int32_t *buf;
+                    scan_size = (full_count + count) * 2;
+                    buf = realloc(scan_buf, scan_size * channels * sizeof(int32_t));
+                    if (!buf) {
+                        if (!opt_quiet) fprintf(stderr, "Out of memory\n");
+                        return 1;
+                    }
+                    scan_buf = buf;
+                }
+                memcpy(scan_buf + full_count * channels, process_buf, count * channels * sizeof(int32_t));
+                full_count += count;
+                if (read < nb_samples) break; /* eof */
+                continue;
             }
 
-            /* in -j testing mode only */
-            if (opt_testing)
+            /* in -j testing mode only, the detector follows from
+             * the start, as the context does unless it seeks */
+            if (opt_testing) {
                 dv = hdcd_scan(ctx, process_buf, count, 0);
+                if (opt_start <= 0)
+                    hdcd_detector_scan(&detector, process_buf, count);
+                if (!test_batch(batch, single, process_buf, count)) {
+                    fprintf(stderr, "hdcd_detector_scan_batch() results did not match hdcd_detector_scan()\n");
+                    test_failed = 1;
+                }
+            }
 
-            hdcd_process(ctx, process_buf, count);
+            /* nothing will be written, so there is no need to
+             * decode, only scan (-i, -x, etc.) */
+            if (!outfile && !opt_testing && !index_out)
+                hdcd_scan_process(ctx, process_buf, count);
+            else if (float_buf) {
+                /* as a float source would be */
+                for (i = 0; i < count * channels; i++)
+                    float_buf[i] = (float)process_buf[i] / (1 << (bits_per_sample - 1));
+                if (!hdcd_process_float(ctx, float_buf, count)) {
+                    if (!opt_quiet) fprintf(stderr, "Out of memory\n");
+                    return 1;
+                }
+            } else
+                hdcd_process(ctx, process_buf, count);
 
             /* in -j testing mode only */
             if (opt_testing)
@@ -439,17 +836,58 @@ int main(int argc, char *argv[]) {
                     fprintf(stderr,
                         "hdcd_scan() result did not match hdcd_process(): %d:%d\n",
                         dv, hdcd_detected(ctx) );
+            if (opt_testing && opt_start <= 0)
+                if (hdcd_detector_detected(&detector) != hdcd_detected(ctx)
+                    || hdcd_detector_packet_type(&detector) != hdcd_detect_packet_type(ctx)
+                    || hdcd_detector_total_packets(&detector) != hdcd_detect_total_packets(ctx)
+                    || hdcd_detector_errors(&detector) != hdcd_detect_errors(ctx)
+                    || hdcd_detector_peak_extend(&detector) != hdcd_detect_peak_extend(ctx) )
+                    fprintf(stderr,
+                        "hdcd_detector results did not match hdcd_process(): %d:%d\n",
+                        hdcd_detector_detected(&detector), hdcd_detected(ctx) );
+
+            if (opt_events) {
+                hdcd_event ev;
+                while (hdcd_events_read(ctx, &ev, 1))
+                    print_event(NULL, &ev);
+                if (hdcd_events_lost(ctx) > events_lost) {
+                    events_lost = hdcd_events_lost(ctx);
+                    fprintf(stderr, "event: %d lost\n", events_lost);
+                }
+            }
+
+            /* in -j testing mode, carry on from a copy of the state,
+             * alternating between a snapshot and a clone, so the
+             * results of every test depend on both being exact */
+            if (opt_testing && !test_copy_state(&ctx, full_count / frame_length))
+                fprintf(stderr, "state snapshot/clone failed\n");
+            if (opt_testing && opt_events) {
+                hdcd_events_buffer(ctx, events, 64);
+                events_lost = 0;
+            }
+            if (opt_testing && lut)
+                hdcd_lut_attach(ctx, lut);
         }
 
 
         if (outfile) {
-            wav_write_samples(wav_out, process_buf, count * channels);
+            /* -G: decoded from the index entry, written from the start */
+            int from = (skip < count) ? (int)skip : count;
+            if (float_buf) {
+                /* -n: the input, at 32-bit */
+                if (opt_nop)
+                    for (i = 0; i < count * channels; i++)
+                        float_buf[i] = (float)process_buf[i] / 2147483648.0f;
+                wav_write_samples_float(wav_out, float_buf + from * channels, (count - from) * channels);
+            } else
+                wav_write_samples(wav_out, process_buf + from * channels, (count - from) * channels);
+            skip -= from;
         }
 
         full_count += count;
         if (opt_ki) {
             /* -i mode, break when HDCD is discovered*/
-            if (hdcd_detected(ctx))
+            if (hdcd_detected(ctx) || (opt_depths && hdcd_detect_depth(ctx)))
                 break;
             /* limit scanning to first OPT_KI_SCAN_MAX samples */
             if (full_count >= OPT_KI_SCAN_MAX)
@@ -457,6 +895,43 @@ int main(int argc, char *argv[]) {
         }
         if (read < nb_samples) break; /* eof */
     }
+    if (index_out) {
+        FILE *f = fopen(index_out, "wb");
+        int written = (f && fwrite(index, 1, index_used, f) == (size_t)index_used);
+        if (f) fclose(f);
+        if (!written) {
+            if (!opt_quiet) fprintf(stderr, "Can't write seek index: %s\n", index_out);
+            return 1;
+        }
+    }
+    if (opt_threads) {
+        /* scanned or decoded as the same blocks would have been */
+        if (outfile) {
+            long from = (skip < full_count) ? skip : full_count;
+            hdcd_process_parallel(ctx, scan_buf, full_count, frame_length, opt_threads);
+            wav_write_samples(wav_out, scan_buf + from * channels, (full_count - from) * channels);
+        } else
+            hdcd_scan_parallel(ctx, scan_buf, full_count, frame_length, opt_threads);
+    }
+    if (sampled && !opt_quiet) {
+        /* share of the windows that agree with the result */
+        int agree = (hdcd_detected(ctx)) ? sparse.found : sparse.windows - sparse.found;
+        fprintf(stderr, "Sampled %d windows of %0.1fs, %ld of %ld frames (%0.1f%%)\n",
+            sparse.windows, opt_sparse_len, sparse.frames, sparse.total, 100.0 * sparse.frames / sparse.total);
+        fprintf(stderr, "HDCD detected in %d of %d windows, confidence: %0.0f%%\n",
+            sparse.found, sparse.windows, 100.0 * agree / sparse.windows);
+    }
+    if (opt_depths) {
+        /* report the rest at the bit depth that was found */
+        i = hdcd_detect_depth(ctx);
+        if (i) hdcd_select_depth(ctx, i);
+        if (!opt_quiet) {
+            if (i)
+                fprintf(stderr, "HDCD found at %d-bit\n", i);
+            else
+                fprintf(stderr, "HDCD not found at any bit depth\n");
+        }
+    }
     if (xmode) {
         if (xmode == 1)
             /* return non-zero if (-x) mode and HDCD not detected */
@@ -468,6 +943,9 @@ int main(int argc, char *argv[]) {
             /* return non-zero if (-xxx) mode and PE not used */
             exit_value = ( hdcd_detected(ctx) && hdcd_detect_peak_extend(ctx) ) ? 0 : 1;
     }
+    /* -j: fail the test, whatever the mode expects */
+    if (test_failed)
+        exit_value = 2;
 
     if (opt_ki) {
         /* strings are exactly those given by Key's hdcd.exe -i */
@@ -498,6 +976,11 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, ".max_gain_adjustment: %0.1f dB\n", hdcd_detect_max_gain_adjustment(ctx) );
             fprintf(stderr, ".cdt_expirations: %d\n", hdcd_detect_cdt_expirations(ctx) );
             fprintf(stderr, ".lle_mismatch: %d sample(s)\n", hdcd_detect_lle_mismatch(ctx) );
+            if (lut) {
+                int hits, misses;
+                hdcd_lut_stats(lut, &hits, &misses);
+                fprintf(stderr, ".lut_runs: %d hit, %d missed\n", hits, misses);
+            }
         } else {
             hdcd_detect_str(ctx, dstr, sizeof(dstr));
             fprintf(stderr, "%s\n", dstr);
@@ -505,9 +988,13 @@ int main(int argc, char *argv[]) {
     }
 
     free(process_buf);
+    free(float_buf);
+    free(scan_buf);
+    free(index);
     wav_close(wav);
     if (outfile) wav_close(wav_out);
     hdcd_free(ctx);
+    hdcd_lut_free(lut);
 
     return exit_value;
 }
@@ -51,6 +51,9 @@ struct wavio {
     int length_loc;
     int data_size_loc;
 
+    long data_start;     /* -1 if the input can't seek */
+    uint32_t data_total;
+
     uint8_t* input_buf;
     int input_buf_size;
 };
@@ -147,7 +150,7 @@ static int fwrite_int32el(int32_t v, FILE *fp) {
     return fwrite(&b, 1, 4, fp);
 }
 
-wavio *wav_write_open(const char *filename, int channels, int sample_rate, int bits_per_sample, int raw, int expected_data_length)
+static wavio *wav_write_open_format(const char *filename, int format, int channels, int sample_rate, int bits_per_sample, int raw, int expected_data_length)
 {
     wavio* wav = malloc(sizeof(wavio));
     if (!wav) return NULL;
@@ -155,7 +158,7 @@ wavio *wav_write_open(const char *filename, int channels, int sample_rate, int b
 
     if (bits_per_sample == 0) return NULL;
 
-    wav->format = 1;
+    wav->format = format;
     wav->ex = 0;
     wav->channels = channels;
     wav->channel_mask = duh_channel_mask(channels);
@@ -193,8 +196,10 @@ wavio *wav_write_open(const char *filename, int channels, int sample_rate, int b
         fwrite_int32el(-1, wav->fp);
         if (wav->ex)
             fwrite("WAVEfmt \x28\x00\x00\x00\xFE\xFF", 1, 14, wav->fp);
-        else
-            fwrite("WAVEfmt \x10\x00\x00\x00\x01\x00", 1, 14, wav->fp);
+        else {
+            fwrite("WAVEfmt \x10\x00\x00\x00", 1, 12, wav->fp);
+            fwrite_int16el(wav->format, wav->fp);
+        }
         fwrite_int16el(wav->channels, wav->fp);
         fwrite_int32el(wav->sample_rate, wav->fp);
         fwrite_int32el(wav->byte_rate, wav->fp);
@@ -204,7 +209,9 @@ wavio *wav_write_open(const char *filename, int channels, int sample_rate, int b
             fwrite_int16el(22, wav->fp);
             fwrite_int16el(wav->valid_bits_per_sample, wav->fp);
             fwrite_int32el(wav->channel_mask, wav->fp);
-            fwrite("\x01\x00\x00\x00\x00\x00\x10\x00\x80\x00\x00\xAA\x00\x38\x9B\x71", 1, 16, wav->fp);
+            /* the subformat GUID starts with the format */
+            fwrite_int16el(wav->format, wav->fp);
+            fwrite("\x00\x00\x00\x00\x10\x00\x80\x00\x00\xAA\x00\x38\x9B\x71", 1, 14, wav->fp);
         }
         fwrite("data", 1, 4, wav->fp);
         wav->data_size_loc = ftell(wav->fp);
@@ -215,6 +222,31 @@ wavio *wav_write_open(const char *filename, int channels, int sample_rate, int b
     return wav;
 }
 
+wavio *wav_write_open(const char *filename, int channels, int sample_rate, int bits_per_sample, int raw, int expected_data_length)
+{
+    return wav_write_open_format(filename, 1, channels, sample_rate, bits_per_sample, raw, expected_data_length);
+}
+
+wavio *wav_write_open_float(const char *filename, int channels, int sample_rate, int raw, int expected_data_length)
+{
+    return wav_write_open_format(filename, 3, channels, sample_rate, 32, raw, expected_data_length);
+}
+
+int wav_write_samples_float(wavio *wav, const float *samples, int nb_samples)
+{
+    int i;
+    size_t elw = 0;
+
+    if (!wav) return -1;
+    for (i = 0; i < nb_samples; i++) {
+        int32_t v;
+        memcpy(&v, &samples[i], 4);
+        elw += fwrite_int32el(v, wav->fp);
+    }
+    wav->data_length += elw;
+    return elw;
+}
+
 int wav_write_samples(wavio *wav, const int32_t *samples, int nb_samples)
 {
     int i;
@@ -317,6 +349,12 @@ wavio* wav_read_open_raw(const char *filename, int channels, int sample_rate, in
     wav->streamed = 1;
     wav->format = 1;
     wav->ex = (wav->channels > 2 || wav->bits_per_sample > 16) ? 1 : 0;
+    wav->data_start = ftell(wav->fp);
+    if (wav->data_start >= 0 && fseek(wav->fp, 0, SEEK_END) == 0) {
+        wav->data_total = ftell(wav->fp) - wav->data_start;
+        fseek(wav->fp, wav->data_start, SEEK_SET);
+    } else
+        wav->data_start = -1;
     return wav;
 }
 
@@ -383,6 +421,8 @@ try_again:
             wav->data_length = read_int32(wav);
             if (wav->data_length <= 0)
                 wav->streamed = 1;
+            wav->data_start = (wav->streamed) ? -1 : ftell(wav->fp);
+            wav->data_total = wav->data_length;
             if (!wav->valid_bits_per_sample)
                 wav->valid_bits_per_sample = wav->bits_per_sample;
             if (!wav->channel_mask)
@@ -489,6 +529,7 @@ wavio* wav_read_open_ms(const char *filename)
                 wr->data_length = sublength;
                 if (!wr->data_length || wr->streamed) {
                     wr->streamed = 1;
+                    wr->data_start = -1;
                     return wr;
                 }
                 fseek(wr->fp, sublength, SEEK_CUR);
@@ -503,6 +544,8 @@ wavio* wav_read_open_ms(const char *filename)
         }
     }
     fseek(wr->fp, data_pos, SEEK_SET);
+    wr->data_start = data_pos;
+    wr->data_total = wr->data_length;
     return wr;
 }
 
@@ -534,6 +577,25 @@ int wav_read(wavio* wav, unsigned char* data, unsigned int length) {
     return n;
 }
 
+long wav_frames(wavio* wav)
+{
+    if (!wav || wav->write || wav->data_start < 0 || !wav->block_align)
+        return -1;
+    return wav->data_total / wav->block_align;
+}
+
+int wav_seek(wavio* wav, uint32_t frame)
+{
+    long offset;
+    if (wav_frames(wav) < (long)frame) return 0;
+    offset = (long)frame * wav->block_align;
+    if (fseek(wav->fp, wav->data_start + offset, SEEK_SET) != 0)
+        return 0;
+    if (!wav->streamed)
+        wav->data_length = wav->data_total - offset;
+    return 1;
+}
+
 int wav_read_samples(wavio* wav, int32_t* samples, int nb_samples)
 {
     int read, i, bytes_per_sample, input_size;
@@ -29,12 +29,16 @@ typedef struct wavio wavio;
 
 wavio* wav_write_open(const char *filename, int channels, int sample_rate, int bits_per_sample, int raw, int expected_data_length);
 int wav_write_samples(wavio *wav, const int32_t *samples, int nb_samples);
+wavio* wav_write_open_float(const char *filename, int channels, int sample_rate, int raw, int expected_data_length); /* 32-bit IEEE float */
+int wav_write_samples_float(wavio *wav, const float *samples, int nb_samples);
 
 wavio* wav_read_open(const char *filename, int dump_on_fail); /* dumber, but working with pipes version */
 wavio* wav_read_open_ms(const char *filename); /* Martin Storsjo's version */
 wavio* wav_read_open_raw(const char *filename, int channels, int sample_rate, int bits_per_sample);
 int wav_read(wavio* wav, unsigned char* data, unsigned int length);
 int wav_read_samples(wavio* wav, int32_t* samples, int nb_samples);
+long wav_frames(wavio* wav); /* total frames, or -1 if the input can't seek */
+int wav_seek(wavio* wav, uint32_t frame); /* 1 on success */
 
 int wav_get_header(wavio* wav, int* format, int* channels, int* sample_rate, int* bits_per_sample, int *valid_bits_per_sample, unsigned int* data_length);
 void wav_close(wavio *wav);